@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// heap allocations made by the calling thread, counted only in builds with COUNT_ALLOCATIONS
+// (cmake -DCOUNT_ALLOCATIONS=ON), otherwise always 0. ENet packets come from enet_malloc and
+// don't show up here
+inline thread_local uint64_t thread_allocations = 0;
+
+inline uint64_t ThreadAllocations() { return thread_allocations; }
+
+#if defined(COUNT_ALLOCATIONS)
+constexpr bool allocation_counting = true;
+
+// replacements for the global operators. every executable is one translation unit,
+// so this header is compiled once per binary
+void* operator new(std::size_t size) {
+    thread_allocations++;
+    if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+#else
+constexpr bool allocation_counting = false;
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+#include "Game.hpp"
+#include <random>
+
+// decides what a bot presses, reproducible from the seed
+class BotBrain {
+private:
+    std::mt19937 m_rng;
+    uint32_t m_tick = 0;
+    uint32_t m_hold_ticks = 0;
+    PlayerInput m_held{};
+    uint32_t m_phase;
+    bool m_scripted;
+
+public:
+    BotBrain(uint32_t bot_seed, bool scripted) : m_rng(bot_seed), m_phase(bot_seed % iters_per_sec), m_scripted(scripted) {}
+
+    PlayerInput Next() {
+        PlayerInput input{};
+        if (m_scripted) {
+            // walk right for two seconds, left for two seconds, jump every second
+            uint32_t t = m_tick + m_phase;
+            input.right = (t / (iters_per_sec*2)) % 2 == 0;
+            input.left = !input.right;
+            input.up = t % iters_per_sec == 0;
+        }
+        else {
+            if (m_hold_ticks == 0) {
+                uint32_t dir = m_rng() % 3;
+                m_held = PlayerInput{dir == 0, dir == 1, false};
+                m_hold_ticks = 10 + m_rng() % (iters_per_sec*2);
+            }
+            m_hold_ticks--;
+            input = m_held;
+            input.up = m_rng() % (iters_per_sec*2) == 0;
+        }
+        m_tick++;
+        return input;
+    }
+};
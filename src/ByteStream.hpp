@@ -0,0 +1,116 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// round(value / quantum), clamped to the int32 range
+inline int32_t QuantizedSteps(float value, float quantum) {
+    double steps = std::round(double(value) / quantum);
+    steps = fmin(std::numeric_limits<int32_t>::max(), fmax(std::numeric_limits<int32_t>::min(), steps));
+    return int32_t(steps);
+}
+
+// little-endian byte writer used by the snapshot codec
+class ByteWriter {
+private:
+    std::vector<uint8_t>& m_bytes;
+
+public:
+    ByteWriter(std::vector<uint8_t>& bytes) : m_bytes(bytes) {}
+
+    void WriteU8(uint8_t value) { m_bytes.push_back(value); }
+
+    void WriteU32(uint32_t value) {
+        for (int i = 0; i < 4; i++) m_bytes.push_back(uint8_t(value >> (i*8)));
+    }
+
+    void WriteFloat(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        WriteU32(bits);
+    }
+
+    // 7 bits per byte, high bit means "more bytes follow"
+    void WriteVarU32(uint32_t value) {
+        while (value >= 0x80) {
+            m_bytes.push_back(uint8_t(value | 0x80));
+            value >>= 7;
+        }
+        m_bytes.push_back(uint8_t(value));
+    }
+
+    // zigzag so that small negative numbers stay small
+    void WriteVarI32(int32_t value) {
+        WriteVarU32((uint32_t(value) << 1) ^ uint32_t(value >> 31));
+    }
+
+    // stores round(value / quantum), clamped to the int32 range
+    void WriteQuantized(float value, float quantum) {
+        WriteVarI32(QuantizedSteps(value, quantum));
+    }
+
+    size_t Size() const { return m_bytes.size(); }
+};
+
+// reads what ByteWriter wrote, never reads past the end:
+// on overrun every read returns 0 and Ok() becomes false
+class ByteReader {
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_pos = 0;
+    bool m_ok = true;
+
+    bool Require(size_t n) {
+        if (m_ok && m_size - m_pos >= n) return true;
+        m_ok = false;
+        return false;
+    }
+
+public:
+    ByteReader(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+    uint8_t ReadU8() {
+        if (!Require(1)) return 0;
+        return m_data[m_pos++];
+    }
+
+    uint32_t ReadU32() {
+        if (!Require(4)) return 0;
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++) value |= uint32_t(m_data[m_pos++]) << (i*8);
+        return value;
+    }
+
+    float ReadFloat() {
+        uint32_t bits = ReadU32();
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    uint32_t ReadVarU32() {
+        uint32_t value = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (!Require(1)) return 0;
+            uint8_t byte = m_data[m_pos++];
+            value |= uint32_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        m_ok = false; // more than 5 bytes, malformed
+        return 0;
+    }
+
+    int32_t ReadVarI32() {
+        uint32_t value = ReadVarU32();
+        return int32_t(value >> 1) ^ -int32_t(value & 1);
+    }
+
+    float ReadQuantized(float quantum) { return float(ReadVarI32() * double(quantum)); }
+
+    bool Ok() const { return m_ok; }
+    bool AtEnd() const { return m_pos == m_size; }
+    size_t Remaining() const { return m_size - m_pos; }
+};
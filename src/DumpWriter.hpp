@@ -0,0 +1,67 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// writes periodic telemetry files on its own thread, so formatting and disk time stay off the tick.
+// the tick copies its numbers into a T and swaps it in. a dump the thread hasn't started when the
+// next one comes is replaced by it, telemetry only needs the newest
+template<typename T>
+class DumpWriter {
+private:
+    std::function<void(const T&)> m_write;
+
+    // writer thread only
+    T m_working{};
+
+    // shared with the tick
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    T m_pending{};
+    bool m_has_pending = false;
+    bool m_stopping = false;
+    std::thread m_thread;
+
+    void Run() {
+        std::unique_lock lock(m_mutex);
+        while (true) {
+            m_wake.wait(lock, [this](){ return m_stopping || m_has_pending; });
+            if (!m_has_pending) break;
+            std::swap(m_working, m_pending);
+            m_has_pending = false;
+            lock.unlock();
+            m_write(m_working);
+            lock.lock();
+        }
+    }
+
+public:
+    DumpWriter(std::function<void(const T&)> write) : m_write(std::move(write)) {
+        m_thread = std::thread([this](){ Run(); });
+    }
+
+    // writes what is still pending
+    ~DumpWriter() {
+        {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    DumpWriter(const DumpWriter&) = delete;
+    DumpWriter& operator=(const DumpWriter&) = delete;
+
+    // hands data to the writer thread. data comes back holding storage to fill next time
+    void Submit(T& data) {
+        {
+        std::lock_guard lock(m_mutex);
+        std::swap(m_pending, data);
+        m_has_pending = true;
+        }
+        m_wake.notify_one();
+    }
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+// fixed window of ticks, slot = tick % capacity.
+// each slot keeps its vector's capacity after being dropped, so once every slot
+// has seen its busiest tick, adding and dropping events no longer allocates
+template<typename GameEventType>
+class EventHistory {
+public:
+    using Entry = std::pair<uint32_t, GameEventType>; // player id, event
+
+private:
+    struct TickSlot {
+        uint32_t tick = 0;
+        std::vector<Entry> events;
+    };
+
+    std::vector<TickSlot> m_slots;
+    uint32_t m_first_tick = 0; // oldest tick the window holds
+    uint32_t m_end_tick = 0;   // one past the newest tick that got an event
+
+    TickSlot& Slot(uint32_t tick) { return m_slots[tick & (m_slots.size()-1)]; }
+    const TickSlot& Slot(uint32_t tick) const { return m_slots[tick & (m_slots.size()-1)]; }
+
+public:
+    // capacity is rounded up to a power of two
+    EventHistory(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        m_slots.resize(size);
+    }
+
+    size_t Capacity() const { return m_slots.size(); }
+    uint32_t FirstTick() const { return m_first_tick; }
+
+    // events older than the window are refused; newer ones slide the window forward,
+    // dropping the oldest ticks
+    bool Add(uint32_t tick, uint32_t id, const GameEventType& event) {
+        if (tick < m_first_tick) return false;
+        if (tick - m_first_tick >= m_slots.size()) Drop(tick - m_slots.size());
+
+        TickSlot& slot = Slot(tick);
+        if (slot.tick != tick) {
+            slot.tick = tick;
+            slot.events.clear();
+        }
+        slot.events.push_back({id, event});
+        if (tick >= m_end_tick) m_end_tick = tick+1;
+        return true;
+    }
+
+    std::span<const Entry> Find(uint32_t tick) const {
+        if (tick < m_first_tick || tick >= m_end_tick) return {};
+        const TickSlot& slot = Slot(tick);
+        if (slot.tick != tick) return {};
+        return slot.events;
+    }
+
+    // drops every tick up to and including last_dropped_tick
+    void Drop(uint32_t last_dropped_tick) {
+        if (last_dropped_tick < m_first_tick) return;
+
+        uint32_t end = last_dropped_tick+1;
+        if (end - m_first_tick >= m_slots.size()) {
+            for (TickSlot& slot : m_slots) slot.events.clear();
+        }
+        else {
+            for (uint32_t tick = m_first_tick; tick < end && tick < m_end_tick; tick++) {
+                Slot(tick).events.clear();
+            }
+        }
+        m_first_tick = end;
+        if (m_end_tick < m_first_tick) m_end_tick = m_first_tick;
+    }
+
+    // empties the window without moving it
+    void Clear() {
+        for (TickSlot& slot : m_slots) slot.events.clear();
+        m_end_tick = m_first_tick;
+    }
+
+    // f(tick, events) for every tick in the window that has events, oldest first
+    template<typename F>
+    void ForEach(F f) const {
+        for (uint32_t tick = m_first_tick; tick < m_end_tick; tick++) {
+            std::span<const Entry> events = Find(tick);
+            if (!events.empty()) f(tick, events);
+        }
+    }
+};
@@ -1,16 +1,16 @@
 #pragma once
 
 #include "GameBase.hpp"
+#include "ByteStream.hpp"
+#include "PlayerStorage.hpp"
+#include "PhysicsKernel.hpp"
 #include <variant>
 #include <raylib.h>
 #include <raymath.h>
 
-#include <nlohmann/json.hpp>
 #include <fstream>
 #include <memory>
 
-constexpr int max_string_len = 1024;
-
 constexpr int iters_per_sec = 60;
 constexpr double dt = 1.f/iters_per_sec;
 constexpr double gravity = 40;
@@ -20,10 +20,16 @@ constexpr double jump_impulse = 30;
 
 
 // client also uses that
-constexpr uint32_t tick_period = iters_per_sec/10; // broadcast game state every 100 ms
+constexpr uint32_t tick_period = iters_per_sec/20; // server rebuilds the game state every 50 ms, each client gets every 1st to 8th of them
 constexpr uint32_t receive_tick_period = iters_per_sec; // allow late received events
-constexpr uint32_t send_tick_period = iters_per_sec*2; // sync client's tick with server's tick
+constexpr uint32_t send_tick_period = iters_per_sec*2; // clients resync their tick clock with the server this often
 constexpr uint32_t server_lateness = receive_tick_period;
+constexpr uint32_t max_input_lead = receive_tick_period; // inputs further ahead of the server are refused, they would slide the event window
+constexpr uint32_t snapshot_history_len = 32; // snapshots kept as delta baselines, ~3 s at 10 Hz
+constexpr uint32_t state_history_ticks = iters_per_sec*4; // how far back late events can resimulate from a keyframe
+constexpr uint32_t keyframe_interval = 2;
+
+constexpr bool quantize_snapshots = false; // lossy, but roughly halves the snapshot size
 
 enum EventId {
     EV_PLAYER_JOIN = 0,
@@ -41,7 +47,11 @@ struct PlayerInput {
 
     float GetX() { return right - left; }
     
-    bool IsEmpty() { return GetX() == 0 & !up; }
+    bool IsEmpty() { return GetX() == 0 && !up; }
+
+    // 3 bits for the wire and the replay log
+    uint8_t Pack() const { return right | left << 1 | up << 2; }
+    static PlayerInput Unpack(uint8_t bits) { return PlayerInput{bool(bits & 1), bool(bits & 2), bool(bits & 4)}; }
     
     void Detect() {    
         right = IsKeyDown(KEY_D);
@@ -50,29 +60,59 @@ struct PlayerInput {
     }
 };
 
+// the alternative's index is the EventId used on the wire and in the replay log
 struct GameEvent {
-    EventId event_id; // for sending over the net
-    std::variant<std::monostate, PlayerJoin, PlayerLeave, PlayerInput> data;
-};
+    std::variant<PlayerJoin, PlayerLeave, PlayerInput> data;
 
-struct PlayerState {
-    Vector2 position;
-    Vector2 velocity;
+    EventId Id() const { return EventId(data.index()); }
 };
+static_assert(std::is_same_v<std::variant_alternative_t<EV_PLAYER_JOIN, decltype(GameEvent::data)>, PlayerJoin>);
+static_assert(std::is_same_v<std::variant_alternative_t<EV_PLAYER_LEAVE, decltype(GameEvent::data)>, PlayerLeave>);
+static_assert(std::is_same_v<std::variant_alternative_t<EV_PLAYER_INPUT, decltype(GameEvent::data)>, PlayerInput>);
 
 struct GameState {
-    std::map<uint32_t, PlayerState> players;
+    PlayerStorage players;
+};
+
+// snapshot schema: every serialized PlayerState component, in wire order.
+// quantum is the step used when quantization is enabled
+struct PlayerField {
+    Vector2 PlayerState::* vec;
+    float Vector2::* comp;
+    float quantum;
+};
+
+constexpr PlayerField player_schema[] = {
+    {&PlayerState::position, &Vector2::x, 1.f/16},
+    {&PlayerState::position, &Vector2::y, 1.f/16},
+    {&PlayerState::velocity, &Vector2::x, 1.f/256},
+    {&PlayerState::velocity, &Vector2::y, 1.f/256},
 };
 
+enum SnapshotFlags : uint8_t {
+    SNAPSHOT_QUANTIZED = 1 << 0,
+    SNAPSHOT_DELTA = 1 << 1,
+    SNAPSHOT_COMPRESSED = 1 << 2, // everything after the flags byte went through LzCompressor, see shared.hpp
+};
+
+// binary snapshot, size grows with the player count
+// full layout: flags, player count, then per player: id, schema fields
+// delta layout: flags, removed count, removed ids,
+//               changed count, then per player: id, field mask, changed fields
 struct SerializedGameState {
-    char text[max_string_len];
-    uint32_t tick;
+    uint32_t tick = 0;
+    uint32_t baseline_tick = 0; // equals tick for full snapshots
+    uint32_t checksum = 0;      // of the state the client ends up with, see Game::Checksum
+    uint32_t self_checksum = 0; // the receiving client's own player in the server's full precision state, see Game::PlayerChecksum
+    std::vector<uint8_t> bytes;
 
-    SerializedGameState(const char* str) { 
-        std::strncpy(text, str, sizeof(text));
-        text[sizeof(text)-1] = '\0';
-    }
-    SerializedGameState() = default; // needed for packet data, because before copying the data, the lvalue is declared
+    bool IsDelta() const { return baseline_tick != tick; }
+};
+
+// SerializeDeltaInto's working memory, kept by the caller so encoding stops allocating once it has grown
+struct DeltaScratch {
+    std::vector<uint32_t> removed;
+    std::vector<std::pair<uint32_t, uint8_t>> changed; // index in state, field mask
 };
 
 struct DrawingData {
@@ -82,126 +122,338 @@ struct DrawingData {
     bool uses_special_id = true;
 };
 
-class Game : public GameBase<GameState, GameEvent, SerializedGameState> {
+// statically dispatched, GameBase<GameState, GameEvent, SerializedGameState> is the virtual equivalent.
+// the snapshot codec and checksums are static, they need no Game, e.g. on the snapshot encoder's thread
+class Game : public StaticGameBase<Game, GameState, GameEvent> {
 public:
-    PlayerState InitNewPlayer(const GameState& state, uint32_t id) {
-        return PlayerState{Vector2{0, 0}};
-    }
-
-    virtual void ApplyEvent(GameState& state, const GameEvent& event, uint32_t id) {
-        switch (event.event_id) {
-        case EV_PLAYER_JOIN:
-            state.players[id] = InitNewPlayer(state, id);
-            break;
-
-        case EV_PLAYER_LEAVE:
-            state.players.erase(id);
-            break;
-
-        case EV_PLAYER_INPUT:
-            if (std::holds_alternative<PlayerInput>(event.data)) {
-                auto input = std::get<PlayerInput>(event.data);
-                if (state.players.find(id) != state.players.end()) {
-                    state.players[id].velocity.x += input.GetX() * dt * hor_speed;
-                    if (input.up && state.players[id].position.y == floor_lvl) state.players[id].velocity.y -= jump_impulse;
+    Game() {
+        ConfigureStateHistory(state_history_ticks, keyframe_interval);
+    }
+
+    static PlayerState InitNewPlayer(const GameState&, uint32_t) {
+        return PlayerState{Vector2{0, 0}, Vector2{0, 0}};
+    }
+
+    void ApplyEvent(GameState& state, const GameEvent& event, uint32_t id) {
+        std::visit([&](const auto& data) { Apply(state, data, id); }, event.data);
+    }
+
+    void Apply(GameState& state, const PlayerJoin&, uint32_t id) {
+        state.players.Set(id, InitNewPlayer(state, id));
+    }
+
+    void Apply(GameState& state, const PlayerLeave&, uint32_t id) {
+        state.players.Remove(id);
+    }
+
+    void Apply(GameState& state, PlayerInput input, uint32_t id) {
+        uint32_t index = state.players.Find(id);
+        if (index == PlayerStorage::npos) return;
+        state.players.VelocitiesX()[index] += input.GetX() * dt * hor_speed;
+        if (input.up && state.players.PositionsY()[index] == floor_lvl) state.players.VelocitiesY()[index] -= jump_impulse;
+    }
+
+    void Draw(const GameState& state, const void* data) {
+        const DrawingData* drawing_data = static_cast<const DrawingData*>(data);
+        for (size_t i = 0; i < state.players.Size(); i++) {
+            uint32_t id = state.players.IdAt(i);
+            if ((!drawing_data->uses_special_id) || (drawing_data->inc_exc_sp_id == (id == drawing_data->special_id))) {
+                DrawCircleV(state.players.At(i).position, 10, drawing_data->color);
+            }            
+        }
+    }
+
+    void UpdateGameLogic(GameState& state) {
+        PlayerStorage& players = state.players;
+        IntegratePlayers(players.PositionsX(), players.PositionsY(), players.VelocitiesX(), players.VelocitiesY(),
+                         players.Size(), gravity*dt, floor_lvl, 0.9f);
+    }
+
+    GameState Lerp(const GameState& state1, const GameState& state2, float alpha, const void* data) {
+        GameState lerped;
+        LerpInto(lerped, state1, state2, fmin(1, fmax(0, alpha)), data);
+        return lerped;
+    };
+
+    // writes into out, whose storage is reused once it has grown to the player count.
+    // alpha above 1 extrapolates along state1 -> state2
+    void LerpInto(GameState& out, const GameState& state1, const GameState& state2, float alpha, const void* data) {
+        alpha = fmax(0, alpha);
+        out.players = state2.players;
+
+        const uint32_t* except_id = static_cast<const uint32_t*>(data);
+
+        for (size_t i = 0; i < state2.players.Size(); i++) {
+            uint32_t id = state2.players.IdAt(i);
+            if (id != *except_id) {
+                uint32_t index1 = state1.players.Find(id);
+                if (index1 != PlayerStorage::npos) {
+                    PlayerState player = state2.players.At(i);
+                    player.position = Vector2Lerp(state1.players.At(index1).position, player.position, alpha);
+                    out.players.SetAt(i, player);
                 }
             }
-            break; 
+        }
+    }
 
-        default:
-            break;
+    uint64_t Checksum(const GameState& state) {
+        return Checksum(state, false);
+    }
+
+    // sum of a per-player hash, so storage order doesn't matter and a player can be added or
+    // taken out without rehashing the rest. quantized hashes the steps a quantized snapshot
+    // carries, which is what a client decoding it ends up with
+    static uint64_t Checksum(const GameState& state, bool quantized) {
+        uint64_t sum = Mix64(state.players.Size());
+        for (size_t i = 0; i < state.players.Size(); i++) {
+            sum += PlayerHash(state.players.IdAt(i), state.players.At(i), quantized);
         }
+        return sum;
     }
 
-    virtual void Draw(const GameState& state, const void* data) {
-        for (const auto& [id, player] : state.players) {
-            const DrawingData* drawing_data = static_cast<const DrawingData*>(data);
-            if ((!drawing_data->uses_special_id) || (drawing_data->inc_exc_sp_id == (id == drawing_data->special_id))) {
-                DrawCircleV(player.position, 10, drawing_data->color);
-            }            
+    // one player's share of Checksum, 0 if it isn't in state
+    static uint64_t PlayerChecksum(const GameState& state, uint32_t id, bool quantized = false) {
+        uint32_t index = state.players.Find(id);
+        return index != PlayerStorage::npos ? PlayerHash(id, state.players.At(index), quantized) : 0;
+    }
+
+    // the running tick hashes cover only this player, e.g. the one a client predicts.
+    // the whole state until it's called
+    void SetTickHashPlayer(uint32_t id) {
+        m_has_tick_hash_player = true;
+        m_tick_hash_player = id;
+    }
+
+    uint64_t TickHash(const GameState& state) const {
+        return m_has_tick_hash_player ? PlayerChecksum(state, m_tick_hash_player) : Checksum(state, false);
+    }
+
+    static uint32_t FoldChecksum(uint64_t checksum) { return uint32_t(checksum ^ (checksum >> 32)); }
+
+    SerializedGameState Serialize(const GameState& state) {
+        return Serialize(state, m_quantize_snapshots);
+    }
+
+    SerializedGameState Serialize(const GameState& state, bool quantize) {
+        SerializedGameState data;
+        SerializeInto(data, state, quantize);
+        return data;
+    }
+
+    // the Into variants overwrite data's bytes or the out state and keep their capacity,
+    // so encoding into the same object every tick stops allocating once it has grown
+    static void SerializeInto(SerializedGameState& data, const GameState& state, bool quantize) {
+        data.bytes.clear();
+        ByteWriter writer(data.bytes);
+        writer.WriteU8(quantize ? SNAPSHOT_QUANTIZED : 0);
+        writer.WriteVarU32(state.players.Size());
+
+        for (size_t i = 0; i < state.players.Size(); i++) {
+            writer.WriteVarU32(state.players.IdAt(i));
+            PlayerState player = state.players.At(i);
+            for (const PlayerField& field : player_schema) {
+                WriteField(writer, player, field, quantize);
+            }
         }
     }
 
-    virtual void UpdateGameLogic(GameState& state) {
-        for (auto& [id, player] : state.players) {
-            player.velocity.y += gravity*dt;
-            player.position += player.velocity;
-            if (player.position.y > floor_lvl) {
-                player.position.y = floor_lvl;
+    GameState Deserialize(const SerializedGameState& data) {
+        GameState state{};
+        DeserializeInto(state, data);
+        return state;
+    }
+
+    static void DeserializeInto(GameState& state, const SerializedGameState& data) {
+        state.players.Clear();
+        ByteReader reader(data.bytes.data(), data.bytes.size());
+        bool quantized = reader.ReadU8() & SNAPSHOT_QUANTIZED;
+        uint32_t count = reader.ReadVarU32();
+
+        for (uint32_t i = 0; i < count && reader.Ok(); i++) {
+            uint32_t id = reader.ReadVarU32();
+            PlayerState ps{};
+            for (const PlayerField& field : player_schema) {
+                ReadField(reader, ps, field, quantized);
             }
-            player.velocity *= 0.9;
+            if (reader.Ok()) state.players.Set(id, ps);
         }
     }
 
-    void OutputHistory() {
-        bool to_file = true;
-        std::ofstream file("output.txt");
-        std::ostream* out = to_file ? &file : &std::cout;
-    
-        for (auto& [tick, events] : m_event_history) {
-            *out << tick << ":" << events.size() << "\n";
+    // only players and fields that differ from baseline are written;
+    // the caller sets tick and baseline_tick
+    SerializedGameState SerializeDelta(const GameState& baseline, const GameState& state) {
+        SerializedGameState data;
+        SerializeDeltaInto(data, baseline, state);
+        return data;
+    }
+
+    void SerializeDeltaInto(SerializedGameState& data, const GameState& baseline, const GameState& state) {
+        SerializeDeltaInto(data, baseline, state, m_quantize_snapshots, m_delta_scratch);
+    }
+
+    static void SerializeDeltaInto(SerializedGameState& data, const GameState& baseline, const GameState& state, bool quantize, DeltaScratch& scratch) {
+        data.bytes.clear();
+        ByteWriter writer(data.bytes);
+        writer.WriteU8(SNAPSHOT_DELTA | (quantize ? SNAPSHOT_QUANTIZED : 0));
+
+        scratch.removed.clear();
+        for (size_t i = 0; i < baseline.players.Size(); i++) {
+            if (!state.players.Contains(baseline.players.IdAt(i))) scratch.removed.push_back(baseline.players.IdAt(i));
+        }
+        writer.WriteVarU32(scratch.removed.size());
+        for (uint32_t id : scratch.removed) {
+            writer.WriteVarU32(id);
+        }
+
+        scratch.changed.clear();
+        for (size_t i = 0; i < state.players.Size(); i++) {
+            uint32_t base_index = baseline.players.Find(state.players.IdAt(i));
+            uint8_t mask = 0;
+            for (size_t f = 0; f < std::size(player_schema); f++) {
+                if (base_index == PlayerStorage::npos || !SameField(baseline.players.At(base_index), state.players.At(i), player_schema[f])) mask |= 1 << f;
+            }
+            if (mask) scratch.changed.push_back({i, mask});
+        }
+        writer.WriteVarU32(scratch.changed.size());
+        for (auto& [index, mask] : scratch.changed) {
+            writer.WriteVarU32(state.players.IdAt(index));
+            writer.WriteU8(mask);
+            PlayerState player = state.players.At(index);
+            for (size_t f = 0; f < std::size(player_schema); f++) {
+                if (mask & (1 << f)) WriteField(writer, player, player_schema[f], quantize);
+            }
+        }
+    }
+
+    // baseline has to be the state the server used for data.baseline_tick
+    GameState DeserializeDelta(const GameState& baseline, const SerializedGameState& data) {
+        GameState state;
+        DeserializeDeltaInto(state, baseline, data);
+        return state;
+    }
+
+    // state must not be baseline
+    static void DeserializeDeltaInto(GameState& state, const GameState& baseline, const SerializedGameState& data) {
+        ByteReader reader(data.bytes.data(), data.bytes.size());
+        uint8_t flags = reader.ReadU8();
+        bool quantized = flags & SNAPSHOT_QUANTIZED;
+        if (!(flags & SNAPSHOT_DELTA)) return DeserializeInto(state, data);
+        state.players = baseline.players;
+
+        uint32_t removed_count = reader.ReadVarU32();
+        for (uint32_t i = 0; i < removed_count && reader.Ok(); i++) {
+            state.players.Remove(reader.ReadVarU32());
+        }
+
+        uint32_t changed_count = reader.ReadVarU32();
+        for (uint32_t i = 0; i < changed_count && reader.Ok(); i++) {
+            uint32_t id = reader.ReadVarU32();
+            uint8_t mask = reader.ReadU8();
+            uint32_t index = state.players.Find(id);
+            PlayerState ps = index != PlayerStorage::npos ? state.players.At(index) : PlayerState{};
+            for (size_t f = 0; f < std::size(player_schema); f++) {
+                if (mask & (1 << f)) ReadField(reader, ps, player_schema[f], quantized);
+            }
+            if (reader.Ok()) state.players.Set(id, ps);
+        }
+    }
+
+    void SetSnapshotQuantization(bool quantize) { m_quantize_snapshots = quantize; }
+    bool SnapshotQuantization() const { return m_quantize_snapshots; }
+
+    // events of ticks [first_tick, end_tick) for the replay log
+    // layout: tick count, then per tick: event count, per event: player id, event id, input bits
+    std::vector<uint8_t> SerializeEvents(uint32_t first_tick, uint32_t end_tick) const {
+        std::vector<uint8_t> bytes;
+        SerializeEventsInto(bytes, first_tick, end_tick);
+        return bytes;
+    }
+
+    void SerializeEventsInto(std::vector<uint8_t>& bytes, uint32_t first_tick, uint32_t end_tick) const {
+        bytes.clear();
+        ByteWriter writer(bytes);
+        writer.WriteVarU32(end_tick - first_tick);
+        for (uint32_t tick = first_tick; tick < end_tick; tick++) {
+            auto events = m_event_history.Find(tick);
+            writer.WriteVarU32(events.size());
             for (auto& [id, event] : events) {
-                switch (event.event_id) {
-                case EV_PLAYER_INPUT:
-                    {
-                    auto input = std::get<PlayerInput>(event.data);
-                    *out << "\tINPUT\t" << "X: " << input.GetX() << " up: " << input.up << std::endl;
-                    }
-                    break;
+                writer.WriteVarU32(id);
+                writer.WriteU8(event.Id());
+                if (const PlayerInput* input = std::get_if<PlayerInput>(&event.data)) writer.WriteU8(input->Pack());
+            }
+        }
+    }
+
+    // adds what SerializeEvents wrote to the event history, returns the end tick or first_tick on bad data
+    uint32_t AddSerializedEvents(uint32_t first_tick, const uint8_t* data, size_t size) {
+        ByteReader reader(data, size);
+        uint32_t tick_count = reader.ReadVarU32();
+        for (uint32_t tick = first_tick; tick < first_tick + tick_count && reader.Ok(); tick++) {
+            uint32_t count = reader.ReadVarU32();
+            for (uint32_t i = 0; i < count && reader.Ok(); i++) {
+                uint32_t id = reader.ReadVarU32();
+                GameEvent event;
+                switch (reader.ReadU8()) {
                 case EV_PLAYER_JOIN:
-                    *out << "\tJOIN\n" << std::endl;
+                    event.data = PlayerJoin{};
                     break;
                 case EV_PLAYER_LEAVE:
-                    *out << "\tLEAVE\n" << std::endl;
+                    event.data = PlayerLeave{};
                     break;
-                }         
-                *out << std::endl;       
+                case EV_PLAYER_INPUT:
+                    event.data = PlayerInput::Unpack(reader.ReadU8());
+                    break;
+                default:
+                    return first_tick;
+                }
+                if (reader.Ok()) AddEvent(event, id, tick);
             }
         }
+        return reader.Ok() ? first_tick + tick_count : first_tick;
     }
 
-    virtual GameState Lerp(const GameState& state1, const GameState& state2, float alpha, const void* data) {
-        alpha = fmin(1, fmax(0, alpha));
-        GameState lerped = state2;
+private:
+    bool m_quantize_snapshots = quantize_snapshots;
+    bool m_has_tick_hash_player = false;
+    uint32_t m_tick_hash_player = 0;
 
-        const uint32_t* except_id = static_cast<const uint32_t*>(data);
+    DeltaScratch m_delta_scratch;
 
-        for (auto& [id, player] : state2.players) {
-            if (id != *except_id) {
-                if (state1.players.find(id) != state1.players.end()) {
-                    lerped.players[id].position = Vector2Lerp(state1.players.at(id).position, state2.players.at(id).position, alpha);
-                }
-            }
-        }
-        return lerped;
-    };
+    // splitmix64 finalizer
+    static uint64_t Mix64(uint64_t x) {
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
 
-    virtual SerializedGameState Serialize(const GameState& state) {
-        nlohmann::json j;
-        for (const auto& [id, player] : state.players) {
-            j["players"][std::to_string(id)] = {
-                {"px", player.position.x},
-                {"py", player.position.y},
-                {"vx", player.velocity.x},
-                {"vy", player.velocity.y}
-            };
+    static uint64_t PlayerHash(uint32_t id, const PlayerState& player, bool quantized) {
+        uint64_t hash = Mix64(id);
+        for (const PlayerField& field : player_schema) {
+            float value = (player.*field.vec).*field.comp;
+            uint32_t bits;
+            if (quantized) bits = uint32_t(QuantizedSteps(value, field.quantum));
+            else std::memcpy(&bits, &value, sizeof(bits));
+            hash = Mix64(hash ^ bits);
         }
-        return SerializedGameState(j.dump().c_str());
+        return hash;
     }
 
-    GameState Deserialize(SerializedGameState data) {
-        GameState state{};
-        nlohmann::json j = nlohmann::json::parse(std::string(data.text, max_string_len));
-        for (auto& [id_str, player_json] : j["players"].items()) {
-            uint32_t id = static_cast<uint32_t>(std::stoul(id_str));
-            PlayerState ps;
-            ps.position.x = player_json["px"].get<float>();
-            ps.position.y = player_json["py"].get<float>();
-            ps.velocity.x = player_json["vx"].get<float>();
-            ps.velocity.y = player_json["vy"].get<float>();
-            state.players[id] = ps;
-        }
-        return state;
+    static void WriteField(ByteWriter& writer, const PlayerState& player, const PlayerField& field, bool quantize) {
+        float value = (player.*field.vec).*field.comp;
+        if (quantize) writer.WriteQuantized(value, field.quantum);
+        else writer.WriteFloat(value);
+    }
+
+    static void ReadField(ByteReader& reader, PlayerState& player, const PlayerField& field, bool quantized) {
+        (player.*field.vec).*field.comp = quantized ? reader.ReadQuantized(field.quantum) : reader.ReadFloat();
+    }
+
+    // bitwise, so that -0 and 0 count as different and the client ends up with exactly our state
+    static bool SameField(const PlayerState& a, const PlayerState& b, const PlayerField& field) {
+        float va = (a.*field.vec).*field.comp;
+        float vb = (b.*field.vec).*field.comp;
+        return std::memcmp(&va, &vb, sizeof(float)) == 0;
     }
 };
 
@@ -1,69 +1,248 @@
 #pragma once
 #include <cstdint>
 #include <map>
+#include <utility>
 #include <vector>
 #include <iostream>
+#include "EventHistory.hpp"
+
+constexpr size_t event_history_ticks = 1024; // ~17 s at 60 ticks per second
+
+// the simulation loops, with ApplyEvent and UpdateGameLogic resolved at compile time.
+// Derived provides:
+//   void ApplyEvent(GameStateType& state, const GameEventType& event, uint32_t id)
+//   void UpdateGameLogic(GameStateType& state)
+//   uint64_t TickHash(const GameStateType& state), only called when tick hashes are configured
+// so all of them can be inlined into the per-tick loops
+template<typename Derived, typename GameStateType, typename GameEventType>
+class StaticGameBase {
+private:
+    Derived& Self() { return static_cast<Derived&>(*this); }
 
-template<typename GameStateType, typename GameEventType, typename SerializedGameStateType>
-class GameBase {
 protected:
-    // usage: m_event_history[tick][event_index].first() = player id, not all events use this
-    // usage: m_event_history[tick][event_index].first() = event
-    std::map<uint32_t, std::vector<std::pair<uint32_t, GameEventType>>> m_event_history;
-    std::map<uint32_t, GameStateType> m_state_history;
+    // usage: m_event_history.Find(tick)[event_index].first = player id, not all events use this
+    // usage: m_event_history.Find(tick)[event_index].second = event
+    EventHistory<GameEventType> m_event_history{event_history_ticks};
+
+    // state at the start of a tick (before that tick's events), kept every m_keyframe_interval ticks
+    struct Keyframe {
+        uint32_t tick = 0;
+        bool valid = false;
+        GameStateType state{};
+    };
+    // ring indexed by tick / m_keyframe_interval, empty means disabled
+    std::vector<Keyframe> m_state_history;
+    uint32_t m_keyframe_interval = 1;
+    uint32_t m_newest_keyframe_tick = 0;
+
+    // running hashes: TickHash of the state at the start of each simulated tick, ring indexed by tick,
+    // empty means disabled. lets another machine's hash for a recent tick be checked without the state
+    struct TickHashEntry {
+        uint32_t tick = 0;
+        bool valid = false;
+        uint64_t hash = 0;
+    };
+    std::vector<TickHashEntry> m_tick_hashes;
+
+    void RecordTickHash(uint32_t tick, const GameStateType& state) {
+        if (m_tick_hashes.empty()) return;
+        TickHashEntry& entry = m_tick_hashes[tick % m_tick_hashes.size()];
+        entry.tick = tick;
+        entry.valid = true;
+        entry.hash = Self().TickHash(state);
+    }
+
+    Keyframe& KeyframeSlot(uint32_t tick) {
+        return m_state_history[(tick / m_keyframe_interval) % m_state_history.size()];
+    }
+
+    void StoreKeyframe(uint32_t tick, const GameStateType& state) {
+        Keyframe& keyframe = KeyframeSlot(tick);
+        keyframe.tick = tick;
+        keyframe.valid = true;
+        keyframe.state = state;
+        if (tick > m_newest_keyframe_tick) m_newest_keyframe_tick = tick;
+    }
+
+    // an event for `tick` changes every state after it
+    void InvalidateKeyframesAfter(uint32_t tick) {
+        if (m_state_history.empty() || tick >= m_newest_keyframe_tick) return;
+
+        uint32_t span = (m_state_history.size()-1) * m_keyframe_interval;
+        uint32_t oldest = m_newest_keyframe_tick > span ? m_newest_keyframe_tick - span : 0;
+        uint32_t first = (tick / m_keyframe_interval + 1) * m_keyframe_interval;
+        for (uint32_t k = first > oldest ? first : oldest; k <= m_newest_keyframe_tick; k += m_keyframe_interval) {
+            Keyframe& keyframe = KeyframeSlot(k);
+            if (keyframe.tick == k) keyframe.valid = false;
+        }
+    }
 
 public:
-    void AddEvent(GameEventType event, uint32_t id, uint32_t tick) {
-        m_event_history[tick].push_back({id, event});
+    // false if the tick was already dropped from the history
+    bool AddEvent(GameEventType event, uint32_t id, uint32_t tick) {
+        if (!m_event_history.Add(tick, id, event)) return false;
+        InvalidateKeyframesAfter(tick);
+        return true;
+    }
+
+    // ticks_covered should span the longest range passed to ResimulateEvents
+    void ConfigureStateHistory(uint32_t ticks_covered, uint32_t keyframe_interval) {
+        m_keyframe_interval = keyframe_interval;
+        m_state_history.assign(ticks_covered / keyframe_interval + 1, Keyframe{});
+        m_newest_keyframe_tick = 0;
+    }
+
+    // call when start states stop matching the recorded keyframes, e.g. after an authoritative state arrives
+    void InvalidateStateHistory() {
+        for (Keyframe& keyframe : m_state_history) keyframe.valid = false;
+    }
+
+    // keeps the running hashes of the last ticks_covered ticks, 0 turns them off
+    void ConfigureTickHashes(uint32_t ticks_covered) {
+        m_tick_hashes.assign(ticks_covered, TickHashEntry{});
+    }
+
+    // the running hash of the state at the start of tick, as last simulated. false if not kept
+    bool FindTickHash(uint32_t tick, uint64_t& hash) const {
+        if (m_tick_hashes.empty()) return false;
+        const TickHashEntry& entry = m_tick_hashes[tick % m_tick_hashes.size()];
+        if (!entry.valid || entry.tick != tick) return false;
+        hash = entry.hash;
+        return true;
     }
 
     GameStateType ApplyEventsAsOneTick(const GameStateType& start_state) {
         GameStateType result_state = start_state;
-        for (auto& [tick, events] : m_event_history) {
+        m_event_history.ForEach([&](uint32_t tick, auto events) {
             for (auto& [id, event] : events) {
-                ApplyEvent(result_state, event, id);
+                Self().ApplyEvent(result_state, event, id);
             }
-        }
-        UpdateGameLogic(result_state);
-        m_event_history.clear();
+        });
+        Self().UpdateGameLogic(result_state);
+        m_event_history.Clear();
         
         return result_state;
     }
 
     GameStateType ApplyEvents(const GameStateType& start_state, uint32_t start_tick, uint32_t end_tick) {        
         GameStateType result_state = start_state;
+        ApplyEventsInPlace(result_state, start_tick, end_tick);
+        return result_state;
+    }
+
+    // advances state from start_tick to end_tick without copying it
+    void ApplyEventsInPlace(GameStateType& state, uint32_t start_tick, uint32_t end_tick) {
         uint32_t currentTick = start_tick;
 
         while (currentTick < end_tick) {
-            if (m_event_history.find(currentTick) != m_event_history.end()) {
-                for (auto& [id, event] : m_event_history[currentTick]) {
-                    ApplyEvent(result_state, event, id);
-                }
+            for (auto& [id, event] : m_event_history.Find(currentTick)) {
+                Self().ApplyEvent(state, event, id);
             }
-            UpdateGameLogic(result_state);
+            Self().UpdateGameLogic(state);
             currentTick++;
+            RecordTickHash(currentTick, state);
         }
+    }
+
+    // same result as ApplyEvents, but resumes from the newest keyframe that no late event has touched,
+    // so the cost depends on how late the latest event was rather than on the range length.
+    // start_state must be the state at start_tick on the same timeline as the keyframes
+    GameStateType ResimulateEvents(const GameStateType& start_state, uint32_t start_tick, uint32_t end_tick) {
+        return ResimulateEvents(start_state, start_tick, end_tick, [](uint32_t, const GameStateType&) {});
+    }
 
+    // on_tick(tick, state) sees the state at the start of every simulated tick after the resume point
+    template<typename OnTick>
+    GameStateType ResimulateEvents(const GameStateType& start_state, uint32_t start_tick, uint32_t end_tick, OnTick&& on_tick) {
+        GameStateType result_state;
+        ResimulateEventsInto(result_state, start_state, start_tick, end_tick, std::forward<OnTick>(on_tick));
         return result_state;
     }
 
-    void DropEventHistory(uint32_t last_dropped_tick) {
-        for (auto it = m_event_history.begin(); it != m_event_history.end(); ) {
-            if (it->first <= last_dropped_tick) {
-                it = m_event_history.erase(it);
-            } else {
-                ++it;
+    // state goes in at start_tick and comes out at end_tick
+    void ResimulateEventsInPlace(GameStateType& state, uint32_t start_tick, uint32_t end_tick) {
+        ResimulateEventsInto(state, state, start_tick, end_tick, [](uint32_t, const GameStateType&) {});
+    }
+
+    void ResimulateEventsInto(GameStateType& out, const GameStateType& start_state, uint32_t start_tick, uint32_t end_tick) {
+        ResimulateEventsInto(out, start_state, start_tick, end_tick, [](uint32_t, const GameStateType&) {});
+    }
+
+    // out may be start_state. the resume point is copied into out's existing storage, so once
+    // everything has grown to the player count this doesn't allocate
+    template<typename OnTick>
+    void ResimulateEventsInto(GameStateType& out, const GameStateType& start_state, uint32_t start_tick, uint32_t end_tick, OnTick&& on_tick) {
+        if (m_state_history.empty()) {
+            if (&out != &start_state) out = start_state;
+            for (uint32_t currentTick = start_tick; currentTick < end_tick; ) {
+                for (auto& [id, event] : m_event_history.Find(currentTick)) {
+                    Self().ApplyEvent(out, event, id);
+                }
+                Self().UpdateGameLogic(out);
+                currentTick++;
+                RecordTickHash(currentTick, out);
+                on_tick(currentTick, out);
             }
+            return;
+        }
+
+        uint32_t from_tick = start_tick;
+        const GameStateType* from_state = &start_state;
+        uint32_t k = end_tick - end_tick % m_keyframe_interval;
+        for (size_t i = 0; i < m_state_history.size() && k > start_tick; i++) {
+            Keyframe& keyframe = KeyframeSlot(k);
+            if (keyframe.valid && keyframe.tick == k) {
+                from_tick = k;
+                from_state = &keyframe.state;
+                break;
+            }
+            k = k >= m_keyframe_interval ? k - m_keyframe_interval : 0;
+        }
+
+        if (from_state != &out) out = *from_state;
+        if (from_tick == start_tick && start_tick % m_keyframe_interval == 0) StoreKeyframe(start_tick, out);
+
+        for (uint32_t currentTick = from_tick; currentTick < end_tick; ) {
+            for (auto& [id, event] : m_event_history.Find(currentTick)) {
+                Self().ApplyEvent(out, event, id);
+            }
+            Self().UpdateGameLogic(out);
+            currentTick++;
+            if (currentTick % m_keyframe_interval == 0) StoreKeyframe(currentTick, out);
+            RecordTickHash(currentTick, out);
+            on_tick(currentTick, out);
         }
     }
 
+    void DropEventHistory(uint32_t last_dropped_tick) {
+        m_event_history.Drop(last_dropped_tick);
+    }
+
+};
+
+// the same loops behind a virtual interface, for game logic that isn't known at compile time (plugins).
+// every event and tick goes through a virtual call, built-in games derive from StaticGameBase instead
+template<typename GameStateType, typename GameEventType, typename SerializedGameStateType>
+class GameBase : public StaticGameBase<GameBase<GameStateType, GameEventType, SerializedGameStateType>, GameStateType, GameEventType> {
+public:
+    virtual ~GameBase() = default;
+
     virtual void ApplyEvent(GameStateType& state, const GameEventType& event, uint32_t id) = 0;
     virtual void Draw(const GameStateType& state, const void* data) = 0;
     virtual void UpdateGameLogic(GameStateType& state) = 0;
 
+    // must not depend on storage order; equal states give equal checksums on every machine
+    virtual uint64_t Checksum(const GameStateType& state) = 0;
+    // what the running tick hashes cover, override to hash less than the whole state
+    virtual uint64_t TickHash(const GameStateType& state) { return Checksum(state); }
+
     virtual SerializedGameStateType Serialize(const GameStateType& state) = 0;
-    virtual GameStateType Deserialize(SerializedGameStateType data) = 0;
+    virtual GameStateType Deserialize(const SerializedGameStateType& data) = 0;
 
     virtual GameStateType Lerp(const GameStateType& state1, const GameStateType& state2, float alpha, const void* data) = 0;
+    // per-frame variant, games that can reuse out's storage should override it
+    virtual void LerpInto(GameStateType& out, const GameStateType& state1, const GameStateType& state2, float alpha, const void* data) {
+        out = Lerp(state1, state2, alpha, data);
+    }
     //virtual GameStateType ConditionalLerp(const GameStateType& state_0, const GameStateType& state1, const GameStateType& state2, float alpha, const void* data) = 0;
 };
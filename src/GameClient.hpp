@@ -2,6 +2,60 @@
 
 #include <EasyNet/EasyNetClient.hpp>
 #include "shared.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <deque>
+
+constexpr uint32_t prediction_history_len = state_history_ticks; // predictions older than the RTT are never compared
+
+// remote players are shown behind the snapshot stream, so a late or lost snapshot is bridged by its neighbours
+constexpr uint32_t playout_delay_ticks = tick_period*2;  // at least this far behind
+constexpr float playout_delay_intervals = 1.5f;          // and at least this many snapshot intervals
+constexpr uint32_t max_extrapolation_ticks = tick_period*2; // past the newest snapshot, then remote players stop
+constexpr float snapshot_timing_smoothing = 0.1f;        // weight of the newest sample in the lag and interval averages
+
+// clock sync: the local tick runs ahead of the server's by the one way delay and a margin, so inputs
+// arrive just before the server gets to their tick. it converges by running slightly fast or slow
+constexpr uint32_t time_sync_samples = 8;        // the one with the lowest rtt sets the clock, it waited the least in queues
+constexpr uint32_t time_sync_burst = time_sync_samples; // requests tick_period apart after connecting, then every send_tick_period
+constexpr double time_sync_margin_ticks = 1;     // lead on top of the one way delay, twice the rtt jitter and the input send wait
+constexpr double time_sync_gain = 0.01;          // tick rate change per tick of error
+constexpr double time_sync_max_rate = 0.05;      // the local tick runs at most 5% fast or slow
+constexpr double time_sync_snap_ticks = iters_per_sec/4; // further off than this jumps instead
+constexpr double time_sync_smoothing = 0.1;      // weight of the newest sample in the rtt and jitter averages
+
+// what the client measured about itself and last heard about the server, for load tools
+struct ClientStats {
+    uint64_t snapshots_received = 0;
+    uint64_t snapshot_bytes = 0;
+    uint32_t max_snapshot_bytes = 0;
+
+    uint64_t reconciles = 0;     // snapshots checked against the prediction
+    uint64_t resimulations = 0;  // of those, the ones that diverged and were replayed
+
+    uint64_t extrapolated_frames = 0; // the playout point was past the newest snapshot
+
+    uint64_t clock_snaps = 0;       // the local tick jumped instead of converging
+    float max_clock_error_ticks = 0;
+
+    uint64_t checksum_mismatches = 0; // snapshots that decoded to something the server didn't send
+    bool has_mismatch = false;
+    uint32_t first_mismatch_tick = 0;
+
+    // our own player as simulated here against the server's, by the running tick hashes
+    uint64_t self_checks = 0;
+    uint64_t self_divergences = 0;
+    bool has_divergence = false;
+    uint32_t first_divergent_tick = 0;
+    uint32_t last_agreeing_tick = 0; // newest check that agreed before the first divergence, it started after this
+    std::chrono::steady_clock::duration reconcile_time_sum{};
+    std::chrono::steady_clock::duration reconcile_time_max{};
+
+    bool has_server_stats = false;
+    ServerStatsPacketData server_stats{};
+};
 
 class GameClient : public Game {
 private:
@@ -9,59 +63,268 @@ private:
     uint32_t m_id = 0;
     std::shared_ptr<EasyNetClient> m_client;
 
-    uint32_t m_ticks_since_last_recieved_game = 0;
+    std::map<uint32_t, GameState> m_received_history; // decoded snapshots, baselines for deltas and the playout buffer
+    SerializedGameState m_snapshot_data; // reused for every received snapshot
+    GameState m_decoded;
 
-    GameState m_last_received_game{};
-    uint32_t m_last_received_game_tick = 0;
-
-    GameState m_prev_last_received_game{};
-    uint32_t m_prev_last_received_game_tick = 0;    
+    // snapshot timing in ticks, smoothed
+    bool m_has_snapshot_timing = false;
+    float m_snapshot_lag = 0;      // m_tick - snapshot tick on arrival
+    float m_snapshot_interval = tick_period;
+    uint32_t m_playout_delay = playout_delay_ticks;
     
     GameState m_others_game_state{};
     GameState m_self_game_state{};
 
+    // the local player as predicted at the start of each tick, ring indexed by tick
+    struct PredictedSelf {
+        uint32_t tick = 0;
+        bool valid = false;
+        bool present = false; // joined by then
+        PlayerState player{};
+    };
+    std::vector<PredictedSelf> m_predicted_self = std::vector<PredictedSelf>(prediction_history_len);
+
+    void RecordPrediction(uint32_t tick, const GameState& state) {
+        PredictedSelf& predicted = m_predicted_self[tick % m_predicted_self.size()];
+        uint32_t index = state.players.Find(m_id);
+        predicted.tick = tick;
+        predicted.valid = true;
+        predicted.present = index != PlayerStorage::npos;
+        if (predicted.present) predicted.player = state.players.At(index);
+    }
+
+    // within one quantization step per field, so quantized snapshots of a correct prediction still match
+    bool PredictionMatches(uint32_t tick, const GameState& authoritative) const {
+        const PredictedSelf& predicted = m_predicted_self[tick % m_predicted_self.size()];
+        if (!predicted.valid || predicted.tick != tick) return false;
+
+        uint32_t index = authoritative.players.Find(m_id);
+        if (index == PlayerStorage::npos || !predicted.present) return (index == PlayerStorage::npos) == !predicted.present;
+
+        PlayerState player = authoritative.players.At(index);
+        for (const PlayerField& field : player_schema) {
+            float diff = (player.*field.vec).*field.comp - (predicted.player.*field.vec).*field.comp;
+            if (!(std::fabs(diff) <= field.quantum)) return false;
+        }
+        return true;
+    }
+
     uint32_t CalculateTickWinthPing(uint32_t tick) {
-        float delta_sec = m_client->GetPeer()->roundTripTime / 2 / 1000;
-        uint32_t delta_tick = delta_sec * iters_per_sec;
+        float delta_sec = m_client->GetPeer()->roundTripTime / 2.f / 1000;
+        uint32_t delta_tick = std::lround(delta_sec * iters_per_sec);
         return tick + delta_tick;
     }
 
+    // the server's tick as a function of the local clock: LocalSeconds() / dt + m_server_tick_base
+    struct TimeSyncSample {
+        double rtt; // seconds, without the server's hold time
+        double server_tick_base;
+    };
+    std::chrono::steady_clock::time_point m_clock_start = std::chrono::steady_clock::now();
+    std::array<TimeSyncSample, time_sync_samples> m_sync_samples{};
+    uint32_t m_sync_count = 0;
+    uint32_t m_sync_requests = 0;
+    std::chrono::steady_clock::time_point m_next_sync;
+    bool m_has_clock = false;
+    double m_server_tick_base = 0;
+    double m_sync_rtt = 0;
+    double m_sync_rtt_jitter = 0;
+    double m_tick_fraction = 0; // the local tick clock is m_tick + m_tick_fraction
+    PlayerInput m_pending_input{}; // the frame's input until a tick uses it, a jump press waits through frames without one
+
+    double LocalSeconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_clock_start).count();
+    }
+
+    void SendTimeSync() {
+        auto now = std::chrono::steady_clock::now();
+        if (now < m_next_sync) return;
+        uint32_t period = m_sync_requests < time_sync_burst ? tick_period : send_tick_period;
+        m_next_sync = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(period * dt));
+        m_sync_requests++;
+        TimeSyncRequestPacketData request{LocalSeconds()};
+        m_client->SendPacket(CreatePacket<TimeSyncRequestPacketData>(MSG_TIME_SYNC_REQUEST, request, ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT));
+    }
+
+    void OnTimeSync(const TimeSyncPacketData& sync) {
+        double now = LocalSeconds();
+        double rtt = std::max(0.0, now - sync.client_time - (sync.server_send_tick - sync.server_receive_tick) * dt);
+        double server_tick = sync.server_send_tick + rtt / 2 / dt;
+        m_sync_samples[m_sync_count++ % time_sync_samples] = {rtt, server_tick - now / dt};
+
+        const TimeSyncSample* best = &m_sync_samples[0];
+        for (uint32_t i = 1; i < std::min(m_sync_count, time_sync_samples); i++) {
+            if (m_sync_samples[i].rtt < best->rtt) best = &m_sync_samples[i];
+        }
+        m_server_tick_base = best->server_tick_base;
+
+        if (!m_has_clock) {
+            m_sync_rtt = rtt;
+            m_sync_rtt_jitter = 0;
+            m_has_clock = true;
+        }
+        else {
+            m_sync_rtt_jitter += (std::fabs(rtt - m_sync_rtt) - m_sync_rtt_jitter) * time_sync_smoothing;
+            m_sync_rtt += (rtt - m_sync_rtt) * time_sync_smoothing;
+        }
+    }
+
+    // how far the local tick should be ahead of the server's
+    double TickLead() const {
+        return (m_sync_rtt / 2 + 2 * m_sync_rtt_jitter) / dt + (m_input_send_period - 1) + time_sync_margin_ticks;
+    }
+
+    // usually 1, 0 or 2 now and then while the local tick converges on the server's plus the lead
+    uint32_t TicksThisFrame() {
+        if (!m_has_clock) return 1;
+        double target = LocalSeconds() / dt + m_server_tick_base + TickLead();
+        double error = target - (m_tick + m_tick_fraction);
+        m_stats.max_clock_error_ticks = std::max(m_stats.max_clock_error_ticks, float(std::fabs(error)));
+        if (std::fabs(error) > time_sync_snap_ticks) {
+            m_tick = uint32_t(std::max(0.0, std::round(target)));
+            m_tick_fraction = 0;
+            m_has_snapshot_timing = false;
+            m_stats.clock_snaps++;
+            return 1;
+        }
+
+        m_tick_fraction += 1 + std::clamp(error * time_sync_gain, -time_sync_max_rate, time_sync_max_rate);
+        uint32_t ticks = uint32_t(m_tick_fraction);
+        m_tick_fraction -= ticks;
+        return ticks;
+    }
+
     bool m_connected = false;
+    ClientStats m_stats;
+
+    std::deque<std::pair<uint32_t, PlayerInput>> m_recent_inputs; // not older than input_redundancy_ticks
+    uint32_t m_input_send_period = input_send_period;
+
+    void SendInputs() {
+        while (!m_recent_inputs.empty() && m_recent_inputs.front().first + input_redundancy_ticks <= m_tick) {
+            m_recent_inputs.pop_front();
+        }
+        if (m_tick % m_input_send_period != 0) return;
+
+        // sent without inputs too: it tells the server this tick is complete, so it can commit early
+        InputBatch batch;
+        batch.newest_tick = m_tick;
+        batch.inputs.assign(m_recent_inputs.begin(), m_recent_inputs.end());
+        m_client->SendPacket(CreateInputBatchPacket(MSG_PLAYER_INPUT, batch));
+    }
+
+    // called for every snapshot that made it into m_received_history, after it did
+    void RecordSnapshotTiming(uint32_t tick) {
+        float lag = float(m_tick) - float(tick);
+        auto previous = m_received_history.size() > 1 ? std::prev(m_received_history.end(), 2) : m_received_history.end();
+        if (!m_has_snapshot_timing) {
+            m_snapshot_lag = lag;
+            m_has_snapshot_timing = true;
+        }
+        else m_snapshot_lag += (lag - m_snapshot_lag) * snapshot_timing_smoothing;
+        if (previous != m_received_history.end()) {
+            m_snapshot_interval += (float(tick - previous->first) - m_snapshot_interval) * snapshot_timing_smoothing;
+        }
+    }
+
+    // our player as we last simulated it for the snapshot's tick against the server's full precision one.
+    // quantized snapshots have us resimulate from rounded states, so only the others are checked.
+    // a 0 hash means we weren't in our own state yet, we only are from the first snapshot on
+    void CheckSelfHash(const SerializedGameState& data, bool quantized) {
+        uint64_t hash;
+        if (quantized || !FindTickHash(data.tick, hash) || hash == 0) return;
+        m_stats.self_checks++;
+        if (FoldChecksum(hash) == data.self_checksum) {
+            if (!m_stats.has_divergence) m_stats.last_agreeing_tick = data.tick;
+            return;
+        }
+        if (!m_stats.has_divergence) m_stats.first_divergent_tick = data.tick;
+        m_stats.has_divergence = true;
+        m_stats.self_divergences++;
+    }
+
+    // samples the snapshot stream at the playout point into m_others_game_state, reusing its storage
+    void UpdateOthers() {
+        if (!m_has_snapshot_timing || m_received_history.empty()) return;
+        float delay = std::max(float(m_playout_delay), m_snapshot_interval * playout_delay_intervals);
+        float playout_tick = float(m_tick) - m_snapshot_lag - delay;
+
+        auto next = m_received_history.upper_bound(uint32_t(std::max(0.f, playout_tick)));
+        if (next == m_received_history.begin() || m_received_history.size() == 1) {
+            m_others_game_state.players = m_received_history.begin()->second.players;
+            return;
+        }
+        if (next == m_received_history.end()) {
+            // underrun: carry on along the last two snapshots for a while
+            next = std::prev(next);
+            m_stats.extrapolated_frames++;
+            playout_tick = std::min(playout_tick, float(next->first + max_extrapolation_ticks));
+        }
+        auto previous = std::prev(next);
+        float alpha = (playout_tick - float(previous->first)) / float(next->first - previous->first);
+        LerpInto(m_others_game_state, previous->second, next->second, alpha, &m_id);
+    }
 
 public:
 
     std::shared_ptr<EasyNetClient> GetNetClient() { return m_client; }
 
+    // ticks between input packets, 1 sends every tick
+    void SetInputSendPeriod(uint32_t ticks) { m_input_send_period = ticks > 0 ? ticks : 1; }
+
+    // minimum ticks remote players are shown behind the snapshot stream, the snapshot rate can raise it
+    void SetPlayoutDelay(uint32_t ticks) { m_playout_delay = ticks; }
+
     GameClient() {
+        ConfigureTickHashes(prediction_history_len);
         m_client = std::make_shared<EasyNetClient>();
         m_client->CreateClient();
         m_client->SetOnReceive([this](ENetEvent event){OnReceive(event);});
-        m_client->SetOnConnect([this](ENetEvent){m_connected = true;});
+        m_client->SetOnConnect([this](ENetEvent){
+            m_connected = true;
+            m_received_history.clear();
+            m_has_snapshot_timing = false;
+            m_recent_inputs.clear();
+            m_predicted_self.assign(m_predicted_self.size(), PredictedSelf{});
+            ConfigureTickHashes(prediction_history_len);
+            m_has_clock = false;
+            m_sync_count = 0;
+            m_sync_requests = 0;
+            m_next_sync = {};
+            m_tick_fraction = 0;
+            m_pending_input = PlayerInput{};
+        });
         m_client->SetOnDisconnect([this](ENetEvent){m_connected = false;});
     }
 
     void Update() {
-            PlayerInput input;
-            input.Detect();
-
-            if (!input.IsEmpty()) {
-                GameEvent event;
-                event.event_id = EV_PLAYER_INPUT;
-                event.data = input;
-                AddEvent(event, m_id, m_tick);
-
-                PlayerInputPacketData data;
-                data.input = input;
-                data.tick = m_tick;
-                m_client->SendPacket(CreatePacket<PlayerInputPacketData>(MSG_PLAYER_INPUT, data, ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT));
+        PlayerInput input;
+        input.Detect();
+        Update(input);
+    }
+
+    // for headless clients, input comes from the caller instead of the keyboard.
+    // called once a frame, runs as many ticks as the clock sync asks for
+    void Update(PlayerInput input) {
+            SendTimeSync();
+            m_pending_input.right = input.right;
+            m_pending_input.left = input.left;
+            m_pending_input.up = m_pending_input.up || input.up;
+            for (uint32_t ticks = TicksThisFrame(); ticks > 0; ticks--) {
+                PlayerInput tick_input = m_pending_input;
+                if (!tick_input.IsEmpty()) {
+                    AddEvent(GameEvent{tick_input}, m_id, m_tick);
+                    m_recent_inputs.push_back({m_tick, tick_input});
+                }
+                m_pending_input.up = false; // a press is one tick's, also when the frame runs two
+                SendInputs();
+
+                ResimulateEventsInPlace(m_self_game_state, m_tick, m_tick+1);
+                RecordPrediction(m_tick+1, m_self_game_state);
+                m_tick++;
             }
-            
-            m_self_game_state = ApplyEvents(m_self_game_state, m_tick, m_tick+1);
-            float alpha = float(m_ticks_since_last_recieved_game) / float(m_last_received_game_tick-m_prev_last_received_game_tick);
-            m_others_game_state = Lerp(m_prev_last_received_game, m_last_received_game, alpha, &m_id);
- 
-            m_tick++;
-            m_ticks_since_last_recieved_game++;
+            UpdateOthers();
     }
 
     void DrawGame() {
@@ -83,32 +346,92 @@ public:
         switch (msgType) {
         case MSG_GAME_TICK:
             m_tick = CalculateTickWinthPing(ExtractData<uint32_t>(event.packet));
+            m_tick_fraction = 0;
+            m_has_snapshot_timing = false;
             break;
 
         case MSG_PLAYER_ID:
             m_id = ExtractData<uint32_t>(event.packet);
+            SetTickHashPlayer(m_id);
             break;
             
         case MSG_GAME_STATE:
             {
-            m_ticks_since_last_recieved_game = 0;
-            m_prev_last_received_game = m_last_received_game;
-            m_prev_last_received_game_tick = m_last_received_game_tick;
+            SerializedGameState& data = m_snapshot_data;
+            if (!ExtractSnapshot(event.packet, data)) break;
+            if (!m_received_history.empty() && data.tick <= m_received_history.rbegin()->first) break; // out of date
+
+            if (data.IsDelta()) {
+                auto baseline = m_received_history.find(data.baseline_tick);
+                if (baseline == m_received_history.end()) break; // server falls back to a full snapshot
+                DeserializeDeltaInto(m_decoded, baseline->second, data);
+            }
+            else {
+                DeserializeInto(m_decoded, data);
+            }
+
+            // a wrong baseline or a codec bug, treat it as lost so it's never used as a baseline
+            bool quantized = !data.bytes.empty() && (data.bytes[0] & SNAPSHOT_QUANTIZED);
+            if (FoldChecksum(Checksum(m_decoded, quantized)) != data.checksum) {
+                if (!m_stats.has_mismatch) m_stats.first_mismatch_tick = data.tick;
+                m_stats.has_mismatch = true;
+                m_stats.checksum_mismatches++;
+                break;
+            }
+
+            // the oldest snapshot's map node and storage take the new one
+            auto node = m_received_history.size() >= snapshot_history_len ? m_received_history.extract(m_received_history.begin())
+                                                                          : std::map<uint32_t, GameState>::node_type{};
+            if (node) {
+                node.key() = data.tick;
+                std::swap(node.mapped(), m_decoded);
+                m_received_history.insert(std::move(node));
+            }
+            else std::swap(m_received_history[data.tick], m_decoded);
+            const GameState& rec_state = m_received_history.rbegin()->second;
+            m_client->SendPacket(CreatePacket<uint32_t>(MSG_SNAPSHOT_ACK, data.tick, ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT));
+
+            m_stats.snapshots_received++;
+            m_stats.snapshot_bytes += event.packet->dataLength;
+            if (event.packet->dataLength > m_stats.max_snapshot_bytes) m_stats.max_snapshot_bytes = event.packet->dataLength;
+
+            RecordSnapshotTiming(data.tick);
+            CheckSelfHash(data, quantized);
 
-            SerializedGameState data = ExtractData<SerializedGameState>(event.packet);
-            auto rec_state = Deserialize(data);
-            m_self_game_state = ApplyEvents(rec_state, data.tick, m_tick-1);
+            // replay from the authoritative state only when the prediction for its tick was off
+            auto reconcile_start = std::chrono::steady_clock::now();
+            if (!PredictionMatches(data.tick, rec_state)) {
+                InvalidateStateHistory();
+                RecordPrediction(data.tick, rec_state);
+                ResimulateEventsInto(m_self_game_state, rec_state, data.tick, m_tick,
+                    [this](uint32_t tick, const GameState& state) { RecordPrediction(tick, state); });
+                m_stats.resimulations++;
+            }
             DropEventHistory(data.tick);
 
-            m_last_received_game = rec_state;
-            m_last_received_game_tick = data.tick;       
+            auto reconcile_time = std::chrono::steady_clock::now() - reconcile_start;
+            m_stats.reconciles++;
+            m_stats.reconcile_time_sum += reconcile_time;
+            if (reconcile_time > m_stats.reconcile_time_max) m_stats.reconcile_time_max = reconcile_time;
             }
             break;
 
+        case MSG_TIME_SYNC:
+            OnTimeSync(ExtractData<TimeSyncPacketData>(event.packet));
+            break;
+
+        case MSG_SERVER_STATS:
+            m_stats.server_stats = ExtractData<ServerStatsPacketData>(event.packet);
+            m_stats.has_server_stats = true;
+            break;
+
         default:
             break;
         }
     }
 
     bool IsConnected() {return m_connected;}
+
+    const ClientStats& GetStats() const { return m_stats; }
+    void ResetStats() { m_stats = ClientStats{}; }
 };
\ No newline at end of file
@@ -0,0 +1,144 @@
+#pragma once
+#include "Game.hpp"
+#include "BotBrain.hpp"
+#include "ReplayLog.hpp"
+#include <chrono>
+#include <cstring>
+
+constexpr uint32_t headless_chunk_ticks = 64; // ticks per ApplyEvents call, each call copies the state once
+constexpr uint32_t headless_churn_period = iters_per_sec*30; // random mode: a player leaves and rejoins about this often
+
+struct HeadlessResult {
+    uint64_t ticks = 0;
+    uint64_t events = 0;
+    double seconds = 0;
+    uint32_t keyframes_checked = 0;    // recorded runs only
+    uint32_t keyframe_mismatches = 0;
+    uint32_t gaps = 0;
+    uint32_t checksums_checked = 0;
+    uint32_t checksum_mismatches = 0;
+    bool has_mismatch = false;
+    uint32_t first_mismatch_tick = 0; // first checked tick whose state disagreed with the recording
+    GameState final_state;
+
+    double TicksPerSecond() const { return seconds > 0 ? ticks / seconds : 0; }
+};
+
+// drives Game without a window, network or clock, as fast as the cpu allows
+class GameHeadless : public Game {
+private:
+    using clock = std::chrono::steady_clock;
+
+    // bitwise, matched by id since removals reorder players
+    static bool SameState(const GameState& a, const GameState& b) {
+        if (a.players.Size() != b.players.Size()) return false;
+        for (size_t i = 0; i < a.players.Size(); i++) {
+            uint32_t index = b.players.Find(a.players.IdAt(i));
+            if (index == PlayerStorage::npos) return false;
+            PlayerState pa = a.players.At(i), pb = b.players.At(index);
+            if (std::memcmp(&pa, &pb, sizeof(PlayerState)) != 0) return false;
+        }
+        return true;
+    }
+
+public:
+    // players are driven by BotBrain with the same seeds the bots tool uses
+    HeadlessResult RunScripted(uint64_t ticks, uint32_t players, uint32_t seed, bool scripted) {
+        HeadlessResult result;
+        std::vector<BotBrain> brains;
+        for (uint32_t i = 0; i < players; i++) brains.emplace_back(seed * 7919 + i, scripted);
+        std::mt19937 churn_rng(seed);
+
+        auto start = clock::now();
+        GameState state;
+        GameEvent join{PlayerJoin{}};
+        GameEvent leave{PlayerLeave{}};
+        for (uint32_t i = 0; i < players; i++) AddEvent(join, i + 1, 0);
+        result.events += players;
+
+        for (uint64_t chunk_start = 0; chunk_start < ticks; chunk_start += headless_chunk_ticks) {
+            uint32_t chunk_end = uint32_t(std::min<uint64_t>(ticks, chunk_start + headless_chunk_ticks));
+            for (uint32_t tick = chunk_start; tick < chunk_end; tick++) {
+                for (uint32_t i = 0; i < players; i++) {
+                    PlayerInput input = brains[i].Next();
+                    if (!scripted && churn_rng() % headless_churn_period == 0) {
+                        AddEvent(leave, i + 1, tick);
+                        AddEvent(join, i + 1, tick + 1);
+                        result.events += 2;
+                    }
+                    if (input.IsEmpty()) continue;
+                    AddEvent(GameEvent{input}, i + 1, tick);
+                    result.events++;
+                }
+            }
+            state = ApplyEvents(state, chunk_start, chunk_end);
+            DropEventHistory(chunk_end - 1);
+        }
+
+        result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+        result.ticks = ticks;
+        result.final_state = std::move(state);
+        return result;
+    }
+
+    // simulates a recorded match from its first keyframe and checks every later keyframe and
+    // checksum against the simulation. after a gap it restarts at the next keyframe
+    HeadlessResult RunRecorded(const ReplayReader& reader) {
+        HeadlessResult result;
+        auto start = clock::now();
+
+        GameState state;
+        bool synced = false;
+        uint32_t state_tick = 0;
+        ReplayRecord record;
+        for (uint64_t offset = reader.FirstRecordOffset(); reader.RecordAt(offset, record); offset = record.next_offset) {
+            if (record.type == REPLAY_KEYFRAME) {
+                SerializedGameState data;
+                data.bytes.assign(record.payload, record.payload + record.size);
+                GameState keyframe = Deserialize(data);
+                if (synced && record.tick == state_tick) {
+                    result.keyframes_checked++;
+                    if (!SameState(state, keyframe)) {
+                        if (!result.has_mismatch) result.first_mismatch_tick = record.tick;
+                        result.has_mismatch = true;
+                        result.keyframe_mismatches++;
+                    }
+                }
+                state = std::move(keyframe);
+                state_tick = record.tick;
+                synced = true;
+            }
+            else if (record.type == REPLAY_CHECKSUM) {
+                if (!synced || record.tick != state_tick) continue;
+                result.checksums_checked++;
+                if (Checksum(state) != ReplayReader::ReadChecksum(record)) {
+                    if (!result.has_mismatch) result.first_mismatch_tick = record.tick;
+                    result.has_mismatch = true;
+                    result.checksum_mismatches++;
+                }
+            }
+            else if (record.type == REPLAY_EVENTS) {
+                if (!synced) continue;
+                if (record.tick != state_tick) {
+                    result.gaps++;
+                    synced = false;
+                    continue;
+                }
+                uint32_t end_tick = AddSerializedEvents(record.tick, record.payload, record.size);
+                if (end_tick == record.tick) {
+                    synced = false;
+                    continue;
+                }
+                for (uint32_t tick = record.tick; tick < end_tick; tick++) result.events += m_event_history.Find(tick).size();
+                state = ApplyEvents(state, state_tick, end_tick);
+                DropEventHistory(end_tick - 1);
+                result.ticks += end_tick - state_tick;
+                state_tick = end_tick;
+            }
+        }
+
+        result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+        result.final_state = std::move(state);
+        return result;
+    }
+};
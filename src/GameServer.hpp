@@ -1,88 +1,459 @@
 #pragma once
 
-#include <EasyNet/EasyNetServer.hpp>
 #include "shared.hpp"
+#include "ServerNetwork.hpp"
+#include "TickProfiler.hpp"
+#include "SnapshotEncoder.hpp"
+#include "ReplayLog.hpp"
+#include "AllocationCounter.hpp"
+#include "DumpWriter.hpp"
+#include "MetricsFile.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <ctime>
 
+constexpr uint32_t stats_dump_period = iters_per_sec*10;
+const std::string stats_file_prefix = "server_stats_room";
+const std::string replay_file_prefix = "replay_room"; // then room, server start time, first tick
+constexpr uint64_t replay_max_file_bytes = 256 << 20; // a longer match goes on in the next file
+constexpr uint32_t metrics_dump_period = iters_per_sec*5;
+const std::string metrics_file_prefix = "peer_metrics_room"; // .prom, the extension prometheus' textfile collector looks for
+constexpr uint32_t replay_keyframe_period = iters_per_sec*5; // longest replay a seek has to simulate
+
+// adaptive snapshot rate: every peer gets every interval-th state, intervals count in tick_periods
+constexpr uint32_t snapshot_min_interval = 1;        // 20 Hz
+constexpr uint32_t snapshot_start_interval = 2;      // 10 Hz until the link is known
+constexpr uint32_t snapshot_max_interval = 8;        // 2.5 Hz
+constexpr uint32_t snapshot_low_detail_interval = 4; // this slow and slower also drops far players
+constexpr uint32_t snapshot_rate_hold = iters_per_sec*2; // a link has to stay good this long between two speedups
+constexpr uint32_t snapshot_max_unacked = 3;         // unacked snapshots beyond one rtt's worth, more are queueing up
+constexpr uint32_t snapshot_peer_max_bytes_per_sec = 64 << 10; // a speedup has to fit in this
+constexpr uint32_t good_link_rtt_ms = 100;
+constexpr uint32_t bad_link_rtt_ms = 300;
+constexpr float good_link_loss = 0.01f;
+constexpr float bad_link_loss = 0.05f;
+constexpr float bad_link_throttle = 0.5f;
+
+// local time like 20261018-143000, for file names
+inline std::string FileTimeStamp() {
+    std::time_t now = std::time(nullptr);
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y%m%d-%H%M%S", std::localtime(&now));
+    return text;
+}
+
+// ticks of the last snapshots handed to the encoder, oldest first. the oldest go when it's full
+struct SentSnapshots {
+    std::array<uint32_t, snapshot_history_len> ticks{};
+    uint32_t first = 0;
+    uint32_t size = 0;
+
+    uint32_t& At(uint32_t i) { return ticks[(first + i) % ticks.size()]; }
+    uint32_t& Back() { return At(size - 1); }
+    void PopBack() { size--; }
+
+    void Push(uint32_t tick) {
+        if (size == ticks.size()) {
+            first = (first + 1) % ticks.size();
+            size--;
+        }
+        size++;
+        Back() = tick;
+    }
+};
+
+struct PeerSnapshotState {
+    bool has_ack = false;
+    uint32_t acked_tick = 0; // newest snapshot the client decoded, used as delta baseline
+    SentSnapshots sent;
+
+    uint32_t interval = snapshot_start_interval;
+    uint32_t next_snapshot_tick = 0;
+    uint32_t snapshot_count = 0;   // staggers the far player refreshes
+    uint32_t rate_changed_tick = 0;
+
+    bool has_input_horizon = false;
+    uint32_t input_horizon = 0; // the client sent all its inputs before this tick
+
+    // telemetry, totals since the peer connected
+    PeerLinkStats link{};               // latest from the network thread
+    uint64_t inputs = 0;
+    uint64_t late_inputs = 0;           // for ticks before m_snapshot_tick, already simulated, each one costs a resimulation
+    uint64_t input_lateness_ticks = 0;  // m_snapshot_tick - tick, summed over the late ones
+    uint64_t refused_inputs = 0;        // older than the committed tick, lost
+};
+
+// the room's peers at one tick, copied so the metrics file is built and written on another thread
+struct PeerMetricsDump {
+    uint32_t tick = 0;
+    std::vector<std::pair<uint32_t, PeerSnapshotState>> peers; // by id
+};
+
+// one room: an independent match with its own state and event history.
+// rooms are ticked on the worker pool and talk to their peers through a RoomLink
 class GameServer : public Game{
 private:
-    uint32_t m_tick;
-    GameState m_late_game_state;
+    uint32_t m_room_id;
+    uint32_t m_tick = 0;
+    std::chrono::steady_clock::time_point m_tick_start; // when this Update began, the clock sync's zero for m_tick
+    GameState m_late_game_state; // final, at m_committed_tick
+    uint32_t m_committed_tick = 0;
     GameState m_game_state;
-    std::shared_ptr<EasyNetServer> m_server;
+    RoomLink& m_link;
+
+    std::map<uint32_t, PeerSnapshotState> m_peers;
+    bool m_has_snapshot = false;
+    uint32_t m_snapshot_tick = 0;
+    SnapshotJob m_snapshot_job; // swapped with the encoder's, so both keep their storage
+    SnapshotEncoder m_encoder{m_link};
+
+    // reused every tick, so a steady tick doesn't allocate
+    SerializedGameState m_keyframe_data;
+    std::vector<uint8_t> m_event_bytes;
+
+    PeerMetricsDump m_metrics_dump; // swapped with the writer's, so both keep their storage
+    DumpWriter<PeerMetricsDump> m_metrics_writer;
+    ReplayWriter m_replay{iters_per_sec};
+    std::string m_replay_session; // when the server started, a restart doesn't overwrite earlier replays
+    uint32_t m_replay_keyframe_tick = 0;
+    uint32_t m_replay_end_tick = 0; // the last peer left at this tick, the file ends once it's committed
+
+    TickProfiler m_profiler{std::chrono::duration_cast<TickProfiler::clock::duration>(std::chrono::duration<double>(dt))};
+    TickProfileWindow m_stats_window; // swapped with the writer's, so both keep their storage
+    DumpWriter<TickProfileWindow> m_stats_writer;
+    std::chrono::steady_clock::duration m_update_time_sum{};
+    std::chrono::steady_clock::duration m_update_time_max{};
+    uint32_t m_update_count = 0;
+
+    void SendServerStats() {
+        using ms = std::chrono::duration<float, std::milli>;
+        ServerStatsPacketData stats;
+        stats.tick = m_tick;
+        stats.player_count = m_game_state.players.Size();
+        stats.avg_update_ms = m_update_count ? ms(m_update_time_sum).count() / m_update_count : 0;
+        stats.max_update_ms = ms(m_update_time_max).count();
+        m_link.Broadcast(CreatePacket<ServerStatsPacketData>(MSG_SERVER_STATS, stats, ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT));
+
+        m_update_time_sum = {};
+        m_update_time_max = {};
+        m_update_count = 0;
+    }
+
+    // copies the state for the encoder thread, which builds, encodes and sends the peers' snapshots
+    void SendSnapshots(uint32_t tick) {
+        SnapshotJob& job = m_snapshot_job;
+        job.peers.clear();
+        bool any_due = false;
+        for (auto& [id, peer] : m_peers) {
+            bool due = tick >= peer.next_snapshot_tick;
+            job.peers.push_back({id, due, peer.interval >= snapshot_low_detail_interval, peer.snapshot_count, peer.has_ack, peer.acked_tick});
+            if (!due) continue;
+            any_due = true;
+            peer.next_snapshot_tick = tick + peer.interval * tick_period;
+            peer.snapshot_count++;
+            peer.sent.Push(tick);
+        }
+        if (!any_due) return;
+
+        TickProfiler::Scope scope(m_profiler, PHASE_SERIALIZE);
+        job.tick = tick;
+        job.state = m_game_state;
+        if (m_encoder.Submit(job)) OnSnapshotJobReplaced(job, tick);
+    }
+
+    // the replaced job's snapshots go out at tick instead, or not at all for peers due at tick anyway
+    void OnSnapshotJobReplaced(const SnapshotJob& replaced, uint32_t tick) {
+        for (const SnapshotPeer& job_peer : replaced.peers) {
+            if (!job_peer.due) continue;
+            auto it = m_peers.find(job_peer.id);
+            if (it == m_peers.end()) continue;
+            SentSnapshots& sent = it->second.sent;
+            if (sent.size >= 2 && sent.Back() == tick && sent.At(sent.size - 2) == replaced.tick) sent.PopBack();
+            if (sent.size >= 1 && sent.Back() == replaced.tick) sent.Back() = tick;
+        }
+    }
+
+    // only copies, the writer thread builds the file with WritePeerMetrics
+    void DumpPeerMetrics() {
+        m_metrics_dump.tick = m_tick;
+        m_metrics_dump.peers.clear();
+        for (auto& [id, peer] : m_peers) m_metrics_dump.peers.push_back({id, peer});
+        m_metrics_writer.Submit(m_metrics_dump);
+    }
+
+    static void WritePeerMetrics(MetricsFile& file, uint32_t room_id, const PeerMetricsDump& dump) {
+        using PeerValue = double (*)(const PeerSnapshotState&, uint32_t tick);
+        struct PeerMetric {
+            const char* name;
+            const char* type;
+            const char* help;
+            PeerValue value;
+        };
+        static const PeerMetric metrics[] = {
+            {"game_peer_received_bytes_total", "counter", "Bytes received from the peer.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.link.bytes_received); }},
+            {"game_peer_received_packets_total", "counter", "Packets received from the peer.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.link.packets_received); }},
+            {"game_peer_sent_bytes_total", "counter", "Bytes handed to ENet for the peer.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.link.bytes_sent); }},
+            {"game_peer_sent_packets_total", "counter", "Packets handed to ENet for the peer.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.link.packets_sent); }},
+            {"game_peer_snapshot_bytes_total", "counter", "Snapshot bytes sent to the peer.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.link.snapshot_bytes); }},
+            {"game_peer_snapshots_total", "counter", "Snapshots sent to the peer.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.link.snapshots_sent); }},
+            {"game_peer_dropped_snapshots_total", "counter", "Snapshots for the peer dropped over the egress budget.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.link.snapshots_dropped); }},
+            {"game_peer_snapshot_interval_ticks", "gauge", "Ticks between the peer's snapshots.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.interval * tick_period); }},
+            {"game_peer_rtt_ms", "gauge", "ENet round trip time.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.link.rtt_ms); }},
+            {"game_peer_rtt_variance_ms", "gauge", "ENet round trip time variance.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.link.rtt_variance_ms); }},
+            {"game_peer_packet_loss_ratio", "gauge", "ENet packet loss estimate.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.link.packet_loss); }},
+            {"game_peer_inputs_total", "counter", "Inputs received from the peer, without repeats.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.inputs); }},
+            {"game_peer_late_inputs_total", "counter", "Inputs for ticks before the room's simulated (snapshot) tick, each costs a resimulation.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.late_inputs); }},
+            {"game_peer_input_lateness_ticks_total", "counter", "Ticks the late inputs were behind the room's simulated (snapshot) tick, summed.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.input_lateness_ticks); }},
+            {"game_peer_refused_inputs_total", "counter", "Inputs older than the committed tick.",
+                [](const PeerSnapshotState& p, uint32_t) { return double(p.refused_inputs); }},
+            {"game_peer_commit_lag_ticks", "gauge", "Ticks between the server's tick and the first one the peer may still send inputs for.",
+                [](const PeerSnapshotState& p, uint32_t tick) { return p.has_input_horizon && p.input_horizon < tick ? double(tick - p.input_horizon) : 0.0; }},
+        };
+
+        std::string room = "room=\"" + std::to_string(room_id) + "\",peer=\"";
+        for (const PeerMetric& metric : metrics) {
+            file.Metric(metric.name, metric.type, metric.help);
+            for (auto& [id, peer] : dump.peers) file.Sample(metric.name, room + std::to_string(id) + "\"", metric.value(peer, dump.tick));
+        }
+        file.Write(metrics_file_prefix + std::to_string(room_id) + ".prom");
+    }
+
+    // a file per match: from a peer joining the empty room until the last one's leave is committed
+    void OpenReplay() {
+        m_replay.Open(replay_file_prefix + std::to_string(m_room_id) + "_" + m_replay_session + "_" + std::to_string(m_committed_tick) + ".rpl");
+    }
+
+    // first tick some connected client may still send inputs for, m_tick at most
+    uint32_t InputHorizon() const {
+        uint32_t horizon = m_tick;
+        for (auto& [id, peer] : m_peers) {
+            horizon = std::min(horizon, peer.has_input_horizon ? peer.input_horizon : 0);
+        }
+        return horizon;
+    }
+
+    // the server's tick at time, fractional. a tick spans dt from the start of its Update
+    double TickAt(std::chrono::steady_clock::time_point time) const {
+        return m_tick + std::chrono::duration<double>(time - m_tick_start).count() / dt;
+    }
+
+    void HandleNetwork() {
+        NetInbound message;
+        while (m_link.Poll(message)) {
+            switch (message.type) {
+            case NET_CONNECT:
+                OnConnect(message.peer_id);
+                break;
+            case NET_DISCONNECT:
+                OnDisconnect(message.peer_id);
+                break;
+            case NET_PLAYER_INPUT:
+                OnPlayerInput(message.peer_id, message.tick, message.input);
+                break;
+            case NET_SNAPSHOT_ACK:
+                OnSnapshotAck(message.peer_id, message.tick);
+                break;
+            case NET_INPUT_HORIZON:
+                OnInputHorizon(message.peer_id, message.tick);
+                break;
+            case NET_LINK_STATS:
+                OnLinkStats(message.peer_id, message.link);
+                break;
+            case NET_TIME_SYNC:
+                OnTimeSync(message.peer_id, message.sync);
+                break;
+            }
+        }
+    }
 
 public:
 
-    GameServer() {
-        m_server = std::make_shared<EasyNetServer>();
-        m_server->CreateServer(server_port);
-        
-        m_server->SetOnConnect([this](ENetEvent event){this->OnConnect(event);});
-        m_server->SetOnDisconnect([this](ENetEvent event){this->OnDisconnect(event);});
-        m_server->SetOnReceive([this](ENetEvent event){this->OnRecieve(event);});
+    GameServer(RoomLink& link, uint32_t room_id)
+        : m_room_id(room_id), m_link(link),
+          m_metrics_writer([room_id, file = MetricsFile{}](const PeerMetricsDump& dump) mutable {
+              WritePeerMetrics(file, room_id, dump);
+          }),
+          m_replay_session(FileTimeStamp()),
+          m_stats_writer([path = stats_file_prefix + std::to_string(room_id) + ".txt"](const TickProfileWindow& window) {
+              TickProfiler::Write(path, window);
+          }) {
+        m_metrics_dump.peers.reserve(room_capacity);
     }
 
-    void Update() {
-        m_server->Update();
+    TickProfiler& GetProfiler() { return m_profiler; }
 
-        // ensuring that we're not substructing bigger uint32_t from the smaller one
-        uint32_t max_lateness = server_lateness+tick_period+receive_tick_period;
-        
-        if (m_tick % tick_period == 0 && m_tick >= max_lateness) {
-            uint32_t current_tick = m_tick-server_lateness;
+    void Update() {
+        uint64_t allocations = ThreadAllocations();
+        m_tick_start = std::chrono::steady_clock::now();
+        m_profiler.BeginTick();
+        {
+        TickProfiler::Scope scope(m_profiler, PHASE_NETWORK);
+        HandleNetwork();
+        }
 
-            uint32_t previous_tick = current_tick - tick_period;
-            uint32_t current_old_tick = current_tick - receive_tick_period;
-            uint32_t previous_old_tick = previous_tick - receive_tick_period;
+        if (m_tick % tick_period == 0) {
+            // final once every peer has sent its inputs for it, and after the fixed window at the latest
+            uint32_t window_tick = m_tick > server_lateness + receive_tick_period ? m_tick - server_lateness - receive_tick_period : 0;
+            uint32_t commit_tick = std::max({m_committed_tick, window_tick, InputHorizon()});
+            // clients that lag behind hold back the commit, not the snapshots
+            uint32_t snapshot_tick = std::max(m_tick > server_lateness ? m_tick - server_lateness : 0, commit_tick);
 
-            m_late_game_state = ApplyEvents(m_late_game_state, previous_old_tick, current_old_tick);
-            m_game_state = ApplyEvents(m_late_game_state, current_old_tick, current_tick);
+            if (commit_tick > m_committed_tick) {
+                if (m_replay.IsOpen() && m_replay.Size() >= replay_max_file_bytes) OpenReplay();
+                bool record = m_replay.IsOpen();
+                if (record && (m_replay.NeedsKeyframe() || m_committed_tick >= m_replay_keyframe_tick + replay_keyframe_period)) {
+                    TickProfiler::Scope scope(m_profiler, PHASE_SERIALIZE);
+                    SerializeInto(m_keyframe_data, m_late_game_state, false);
+                    m_replay.AddKeyframe(m_committed_tick, m_keyframe_data.bytes);
+                    m_replay_keyframe_tick = m_committed_tick;
+                }
 
-            char buffer[max_string_len];
-            SerializedGameState data = Serialize(m_game_state);
-            data.tick = current_tick;
+                // both resume from keyframes, so only ticks after the latest late event are simulated again
+                {
+                TickProfiler::Scope scope(m_profiler, PHASE_LATE_APPLY);
+                ResimulateEventsInPlace(m_late_game_state, m_committed_tick, commit_tick);
+                }
+                if (record) {
+                    TickProfiler::Scope scope(m_profiler, PHASE_SERIALIZE);
+                    SerializeEventsInto(m_event_bytes, m_committed_tick, commit_tick);
+                    m_replay.AddEvents(m_committed_tick, m_event_bytes);
+                    m_replay.AddChecksum(commit_tick, Checksum(m_late_game_state));
+                    m_replay.Flush();
+                }
+                // exactly the events the committed state contains, later arrivals for these ticks are refused
+                DropEventHistory(commit_tick - 1);
+                m_committed_tick = commit_tick;
+                if (record && m_peers.empty() && m_committed_tick > m_replay_end_tick) m_replay.Finish();
+            }
+            {
+            TickProfiler::Scope scope(m_profiler, PHASE_APPLY);
+            ResimulateEventsInto(m_game_state, m_late_game_state, m_committed_tick, snapshot_tick);
+            }
 
-            ENetPacket* packet = CreatePacket<SerializedGameState>(MSG_GAME_STATE, data);
-            m_server->Broadcast(packet); 
-            DropEventHistory(previous_old_tick);
+            // nothing new to send while the commit is still waiting for a lagging client
+            if (!m_has_snapshot || snapshot_tick > m_snapshot_tick) {
+                SendSnapshots(snapshot_tick);
+                m_has_snapshot = true;
+                m_snapshot_tick = snapshot_tick;
+            }
+        }
+        if (m_tick % iters_per_sec == 0) {
+            TickProfiler::Scope scope(m_profiler, PHASE_BROADCAST);
+            SendServerStats();
         }
+        // inside the measured tick. only copies, the writer threads format and write
+        if (m_tick % stats_dump_period == 0) {
+            m_profiler.TakeWindow(m_stats_window, m_tick);
+            m_stats_writer.Submit(m_stats_window);
+        }
+        if (m_tick % metrics_dump_period == 0) DumpPeerMetrics();
+
+        auto update_time = m_profiler.EndTick();
+        m_profiler.RecordAllocations(ThreadAllocations() - allocations);
+        m_update_time_sum += update_time;
+        if (update_time > m_update_time_max) m_update_time_max = update_time;
+        m_update_count++;
         m_tick++;
     }
 
-    void OnConnect(ENetEvent event) {
-        GameEvent game_event;
-        game_event.event_id = EV_PLAYER_JOIN;
-        uint32_t id = enet_peer_get_id(event.peer);
-        AddEvent(game_event, id, m_tick);
-        m_server->SendTo(id, CreatePacket<uint32_t>(MSG_GAME_TICK, m_tick));
-        m_server->SendTo(id, CreatePacket<uint32_t>(MSG_PLAYER_ID, id));
+    void OnConnect(uint32_t id) {
+        if (!m_replay.IsOpen()) OpenReplay();
+        AddEvent(GameEvent{PlayerJoin{}}, id, m_tick);
+        m_peers[id] = PeerSnapshotState{};
+        m_peers[id].rate_changed_tick = m_tick;
+        m_link.Send(id, CreatePacket<uint32_t>(MSG_GAME_TICK, m_tick));
+        m_link.Send(id, CreatePacket<uint32_t>(MSG_PLAYER_ID, id));
     }
 
-    void OnDisconnect(ENetEvent event) {
-        GameEvent game_event;
-        game_event.event_id = EV_PLAYER_LEAVE;
-        uint32_t id = enet_peer_get_id(event.peer);
-        AddEvent(game_event, id, m_tick);
+    void OnDisconnect(uint32_t id) {
+        AddEvent(GameEvent{PlayerLeave{}}, id, m_tick);
+        m_peers.erase(id);
+        if (m_peers.empty()) m_replay_end_tick = m_tick;
     }
 
-    void OnRecieve(ENetEvent event)
-    {
-        MessageType msgType = ExtractMessageType(event.packet);
-        switch (msgType) {
-        case MSG_PLAYER_INPUT:
-            {
-            PlayerInputPacketData recieved = ExtractData<PlayerInputPacketData>(event.packet);
-            uint32_t id = enet_peer_get_id(event.peer);
+    void OnPlayerInput(uint32_t id, uint32_t tick, PlayerInput input) {
+        if (tick > m_tick + max_input_lead) return;
+        bool added = AddEvent(GameEvent{input}, id, tick);
 
-            GameEvent game_event;
-            game_event.event_id = EV_PLAYER_INPUT;
-            game_event.data = recieved.input;
+        auto it = m_peers.find(id);
+        if (it == m_peers.end()) return;
+        PeerSnapshotState& peer = it->second;
+        peer.inputs++;
+        // the room only simulates up to the snapshot tick, inputs between it and m_tick are on time
+        if (!added) peer.refused_inputs++;
+        else if (m_has_snapshot && tick < m_snapshot_tick) {
+            peer.late_inputs++;
+            peer.input_lateness_ticks += m_snapshot_tick - tick;
+        }
+    }
 
-            AddEvent(game_event, id, recieved.tick);
-            }
-            break;
+    void OnSnapshotAck(uint32_t id, uint32_t tick) {
+        auto it = m_peers.find(id);
+        if (it != m_peers.end() && (!it->second.has_ack || tick > it->second.acked_tick)) {
+            it->second.has_ack = true;
+            it->second.acked_tick = tick;
+        }
+    }
 
-        default:
-            break;
+    // answered right away, the network thread sends it within its poll interval
+    void OnTimeSync(uint32_t id, const TimeSyncRequest& request) {
+        TimeSyncPacketData sync{request.client_time, TickAt(request.received_at), TickAt(std::chrono::steady_clock::now())};
+        m_link.Send(id, CreatePacket<TimeSyncPacketData>(MSG_TIME_SYNC, sync, ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT));
+    }
+
+    void OnInputHorizon(uint32_t id, uint32_t tick) {
+        auto it = m_peers.find(id);
+        if (it == m_peers.end() || (it->second.has_input_horizon && tick <= it->second.input_horizon)) return;
+        it->second.has_input_horizon = true;
+        it->second.input_horizon = tick;
+    }
+
+    // halves a bad link's snapshot rate right away, speeds a good one up a step at a time
+    void OnLinkStats(uint32_t id, const PeerLinkStats& link) {
+        auto it = m_peers.find(id);
+        if (it == m_peers.end()) return;
+        PeerSnapshotState& peer = it->second;
+        peer.link = link;
+
+        // snapshots the client should have acked by now, given its rtt
+        uint32_t period_ms = peer.interval * tick_period * 1000 / iters_per_sec;
+        size_t unacked = 0;
+        for (uint32_t i = 0; i < peer.sent.size; i++) {
+            if (!peer.has_ack || peer.sent.At(i) > peer.acked_tick) unacked++;
         }
+        size_t in_flight = link.rtt_ms / period_ms + 1;
+
+        bool congested = link.packet_loss > bad_link_loss || link.throttle < bad_link_throttle
+            || link.rtt_ms > bad_link_rtt_ms || unacked > in_flight + snapshot_max_unacked;
+        if (congested) {
+            if (peer.interval < snapshot_max_interval) {
+                peer.interval = std::min(peer.interval * 2, snapshot_max_interval);
+                peer.rate_changed_tick = m_tick;
+            }
+            return;
+        }
+
+        bool good = link.packet_loss < good_link_loss && link.throttle >= 1 && link.rtt_ms < good_link_rtt_ms;
+        if (!good || peer.interval <= snapshot_min_interval || m_tick < peer.rate_changed_tick + snapshot_rate_hold) return;
+        // what the link would carry at the next rate, if snapshots stay the size they are
+        uint64_t faster_bytes_per_sec = uint64_t(link.sent_bytes_per_sec) * peer.interval / (peer.interval - 1);
+        if (faster_bytes_per_sec > snapshot_peer_max_bytes_per_sec) return;
+        peer.interval--;
+        peer.rate_changed_tick = m_tick;
     }
-};
\ No newline at end of file
+};
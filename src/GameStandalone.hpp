@@ -7,15 +7,13 @@ constexpr int player_id = 0;
 class GameStandalone : Game {
     
 private:
-    uint32_t m_tick;
+    uint32_t m_tick = 0;
     GameState m_game_state;
     
 public:
 
     GameStandalone() {
-        GameEvent game_event;
-        game_event.event_id = EV_PLAYER_JOIN;
-        AddEvent(game_event, player_id, m_tick);
+        AddEvent(GameEvent{PlayerJoin{}}, player_id, m_tick);
     }
 
     void Update() {
@@ -23,13 +21,10 @@ public:
         input.Detect();
 
         if (!input.IsEmpty()) {
-            GameEvent event;
-            event.event_id = EV_PLAYER_INPUT;
-            event.data = input;
-            AddEvent(event, player_id, m_tick);
+            AddEvent(GameEvent{input}, player_id, m_tick);
         }
         
-        m_game_state = ApplyEvents(m_game_state, m_tick, m_tick+1); 
+        ApplyEventsInPlace(m_game_state, m_tick, m_tick+1);
         m_tick++;
     }
 
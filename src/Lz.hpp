@@ -0,0 +1,117 @@
+#pragma once
+#include "ByteStream.hpp"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// small LZ77 for snapshot payloads, fast rather than tight.
+// layout: raw size, then sequences of
+//   token (literal count << 4 | match length - lz_min_match, 15 in a nibble means more length bytes follow),
+//   extra literal count bytes, literals, match offset u16, extra match length bytes
+// the last sequence has literals only
+constexpr size_t lz_min_match = 4;
+constexpr size_t lz_max_offset = 0xFFFF;
+constexpr size_t lz_max_raw_size = 1 << 24; // default cap, refuses to inflate anything bigger
+
+class LzCompressor {
+private:
+    static constexpr int hash_bits = 12;
+    std::array<uint32_t, 1 << hash_bits> m_table; // position + 1 of the last 4 bytes with that hash, 0 is empty
+
+    static uint32_t Hash(const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return (v * 2654435761u) >> (32 - hash_bits);
+    }
+
+    static void WriteLength(std::vector<uint8_t>& out, size_t length) {
+        while (length >= 255) {
+            out.push_back(255);
+            length -= 255;
+        }
+        out.push_back(uint8_t(length));
+    }
+
+    static void WriteSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literal_count, size_t offset, size_t match_length) {
+        size_t match_code = match_length ? match_length - lz_min_match : 0;
+        out.push_back(uint8_t((std::min<size_t>(literal_count, 15) << 4) | std::min<size_t>(match_code, 15)));
+        if (literal_count >= 15) WriteLength(out, literal_count - 15);
+        out.insert(out.end(), literals, literals + literal_count);
+        if (match_length == 0) return;
+        out.push_back(uint8_t(offset));
+        out.push_back(uint8_t(offset >> 8));
+        if (match_code >= 15) WriteLength(out, match_code - 15);
+    }
+
+public:
+    // appends the compressed form of src to out
+    void Compress(const uint8_t* src, size_t size, std::vector<uint8_t>& out) {
+        ByteWriter(out).WriteVarU32(uint32_t(size));
+        m_table.fill(0);
+
+        size_t anchor = 0, pos = 0;
+        while (size >= lz_min_match && pos + lz_min_match <= size) {
+            uint32_t hash = Hash(src + pos);
+            size_t candidate = m_table[hash];
+            m_table[hash] = uint32_t(pos + 1);
+            if (candidate == 0 || pos - (candidate - 1) > lz_max_offset || std::memcmp(src + candidate - 1, src + pos, lz_min_match) != 0) {
+                pos++;
+                continue;
+            }
+            size_t match = candidate - 1;
+            size_t length = lz_min_match;
+            while (pos + length < size && src[match + length] == src[pos + length]) length++;
+
+            WriteSequence(out, src + anchor, pos - anchor, pos - match, length);
+            pos += length;
+            anchor = pos;
+        }
+        WriteSequence(out, src + anchor, size - anchor, 0, 0);
+    }
+};
+
+// appends the inflated data to out, false on malformed input or if it would inflate to more
+// than max_raw_size. src may come from anyone: nothing is read or referenced outside src and
+// what this call appended, and at most max_raw_size is allocated
+inline bool LzDecompress(const uint8_t* src, size_t size, std::vector<uint8_t>& out, size_t max_raw_size = lz_max_raw_size) {
+    ByteReader header(src, size);
+    uint32_t raw_size = header.ReadVarU32();
+    if (!header.Ok() || raw_size > max_raw_size) return false;
+    size_t pos = size - header.Remaining();
+    size_t start = out.size();
+    out.reserve(start + raw_size);
+
+    auto read_length = [&](size_t& length) {
+        uint8_t extra;
+        do {
+            if (pos >= size) return false;
+            extra = src[pos++];
+            length += extra;
+        } while (extra == 255);
+        return true;
+    };
+
+    while (pos < size) {
+        uint8_t token = src[pos++];
+        size_t literal_count = token >> 4;
+        if (literal_count == 15 && !read_length(literal_count)) return false;
+        if (literal_count > size - pos || out.size() - start + literal_count > raw_size) return false;
+        out.insert(out.end(), src + pos, src + pos + literal_count);
+        pos += literal_count;
+        if (pos == size) break; // last sequence
+
+        if (size - pos < 2) return false;
+        size_t offset = src[pos] | size_t(src[pos + 1]) << 8;
+        pos += 2;
+        size_t length = (token & 15);
+        if (length == 15 && !read_length(length)) return false;
+        length += lz_min_match;
+        size_t produced = out.size() - start;
+        if (offset == 0 || offset > produced || produced + length > raw_size) return false;
+        // byte by byte, matches may overlap what they produce
+        size_t from = out.size() - offset;
+        for (size_t i = 0; i < length; i++) out.push_back(out[from + i]);
+    }
+    return out.size() - start == raw_size;
+}
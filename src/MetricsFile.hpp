@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+// builds a file in the prometheus text format, e.g. for node_exporter's textfile collector.
+// all samples of a metric have to follow its Metric call
+class MetricsFile {
+private:
+    std::string m_text;
+
+public:
+    // type is "counter" or "gauge"
+    void Metric(const char* name, const char* type, const char* help) {
+        m_text += "# HELP ";
+        m_text += name;
+        m_text += " ";
+        m_text += help;
+        m_text += "\n# TYPE ";
+        m_text += name;
+        m_text += " ";
+        m_text += type;
+        m_text += "\n";
+    }
+
+    // labels without braces, like room="0",peer="3"
+    void Sample(const char* name, const std::string& labels, double value) {
+        m_text += name;
+        m_text += "{";
+        m_text += labels;
+        char number[32];
+        std::snprintf(number, sizeof(number), "} %.15g\n", value);
+        m_text += number;
+    }
+
+    // overwrites path and starts over
+    void Write(const std::string& path) {
+        std::string tmp_path = path + ".tmp";
+        {
+            std::ofstream file(tmp_path);
+            file << m_text;
+        }
+        std::rename(tmp_path.c_str(), path.c_str()); // scrapers never see a half written file
+        m_text.clear();
+    }
+};
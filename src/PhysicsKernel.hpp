@@ -0,0 +1,113 @@
+#pragma once
+#include <cstddef>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// one physics tick over structure-of-arrays players:
+//   vy += gravity_step   (in double, like the original float += double)
+//   p  += v
+//   p.y = min(p.y, floor)
+//   v  *= damping        (in float)
+//   v   = 0 if v is denormal
+// every path below rounds exactly like the scalar one, so the paths are bit-identical to each other.
+// without the flush an idle player's velocity settles on a denormal fixed point of v*0.9,
+// and denormal arithmetic is an order of magnitude slower.
+// the flush is a change to the simulation: once a velocity would go denormal, results differ from
+// builds without it. so clients and servers must both have it. replay files all postdate it and
+// reproduce bit-exactly
+
+inline void IntegratePlayersScalar(float* px, float* py, float* vx, float* vy, size_t begin, size_t end,
+                                   double gravity_step, float floor, float damping) {
+    for (size_t i = begin; i < end; i++) {
+        vy[i] += gravity_step;
+        px[i] += vx[i];
+        py[i] += vy[i];
+        if (py[i] > floor) py[i] = floor;
+        vx[i] *= damping;
+        vy[i] *= damping;
+        if (std::fabs(vx[i]) < FLT_MIN) vx[i] = 0;
+        if (std::fabs(vy[i]) < FLT_MIN) vy[i] = 0;
+    }
+}
+
+#if defined(__AVX__)
+inline size_t IntegratePlayersAVX(float* px, float* py, float* vx, float* vy, size_t count,
+                                  double gravity_step, float floor, float damping) {
+    const __m256d step = _mm256_set1_pd(gravity_step);
+    const __m256 floor8 = _mm256_set1_ps(floor);
+    const __m256 damping8 = _mm256_set1_ps(damping);
+    const __m256 sign8 = _mm256_set1_ps(-0.f);
+    const __m256 min_normal8 = _mm256_set1_ps(FLT_MIN);
+    auto flush = [&](__m256 v) {
+        return _mm256_andnot_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign8, v), min_normal8, _CMP_LT_OQ), v);
+    };
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 y = _mm256_loadu_ps(vy + i);
+        __m128 lo = _mm256_cvtpd_ps(_mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(y)), step));
+        __m128 hi = _mm256_cvtpd_ps(_mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(y, 1)), step));
+        y = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+        __m256 x = _mm256_loadu_ps(vx + i);
+
+        __m256 pos_x = _mm256_add_ps(_mm256_loadu_ps(px + i), x);
+        __m256 pos_y = _mm256_add_ps(_mm256_loadu_ps(py + i), y);
+        pos_y = _mm256_blendv_ps(pos_y, floor8, _mm256_cmp_ps(pos_y, floor8, _CMP_GT_OQ));
+
+        _mm256_storeu_ps(px + i, pos_x);
+        _mm256_storeu_ps(py + i, pos_y);
+        _mm256_storeu_ps(vx + i, flush(_mm256_mul_ps(x, damping8)));
+        _mm256_storeu_ps(vy + i, flush(_mm256_mul_ps(y, damping8)));
+    }
+    return i;
+}
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+inline size_t IntegratePlayersSSE2(float* px, float* py, float* vx, float* vy, size_t count,
+                                   double gravity_step, float floor, float damping) {
+    const __m128d step = _mm_set1_pd(gravity_step);
+    const __m128 floor4 = _mm_set1_ps(floor);
+    const __m128 damping4 = _mm_set1_ps(damping);
+    const __m128 sign4 = _mm_set1_ps(-0.f);
+    const __m128 min_normal4 = _mm_set1_ps(FLT_MIN);
+    auto flush = [&](__m128 v) {
+        return _mm_andnot_ps(_mm_cmplt_ps(_mm_andnot_ps(sign4, v), min_normal4), v);
+    };
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 y = _mm_loadu_ps(vy + i);
+        __m128 lo = _mm_cvtpd_ps(_mm_add_pd(_mm_cvtps_pd(y), step));
+        __m128 hi = _mm_cvtpd_ps(_mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(y, y)), step));
+        y = _mm_movelh_ps(lo, hi);
+        __m128 x = _mm_loadu_ps(vx + i);
+
+        __m128 pos_x = _mm_add_ps(_mm_loadu_ps(px + i), x);
+        __m128 pos_y = _mm_add_ps(_mm_loadu_ps(py + i), y);
+        __m128 above = _mm_cmpgt_ps(pos_y, floor4);
+        pos_y = _mm_or_ps(_mm_and_ps(above, floor4), _mm_andnot_ps(above, pos_y));
+
+        _mm_storeu_ps(px + i, pos_x);
+        _mm_storeu_ps(py + i, pos_y);
+        _mm_storeu_ps(vx + i, flush(_mm_mul_ps(x, damping4)));
+        _mm_storeu_ps(vy + i, flush(_mm_mul_ps(y, damping4)));
+    }
+    return i;
+}
+#endif
+
+inline void IntegratePlayers(float* px, float* py, float* vx, float* vy, size_t count,
+                             double gravity_step, float floor, float damping) {
+    size_t done = 0;
+#if defined(__AVX__)
+    done = IntegratePlayersAVX(px, py, vx, vy, count, gravity_step, floor, damping);
+#elif defined(__SSE2__) || defined(_M_X64)
+    done = IntegratePlayersSSE2(px, py, vx, vy, count, gravity_step, floor, damping);
+#endif
+    IntegratePlayersScalar(px, py, vx, vy, done, count, gravity_step, floor, damping);
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <raylib.h>
+
+struct PlayerState {
+    Vector2 position;
+    Vector2 velocity;
+};
+
+// open addressing id -> index table, flat so that copying a state is just a few memcpys
+class IdIndexMap {
+private:
+    static constexpr uint32_t free_slot = UINT32_MAX;
+
+    struct Slot {
+        uint32_t id;
+        uint32_t index = free_slot;
+    };
+    std::vector<Slot> m_slots = std::vector<Slot>(16);
+    size_t m_size = 0;
+
+    size_t Mask() const { return m_slots.size()-1; }
+
+    static size_t Hash(uint32_t id) {
+        id ^= id >> 16;
+        id *= 0x7feb352d;
+        id ^= id >> 15;
+        id *= 0x846ca68b;
+        id ^= id >> 16;
+        return id;
+    }
+
+    void Grow() {
+        std::vector<Slot> old = std::move(m_slots);
+        m_slots.assign(old.size()*2, Slot{});
+        m_size = 0;
+        for (const Slot& slot : old) {
+            if (slot.index != free_slot) Set(slot.id, slot.index);
+        }
+    }
+
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    uint32_t Find(uint32_t id) const {
+        for (size_t i = Hash(id) & Mask(); ; i = (i+1) & Mask()) {
+            if (m_slots[i].index == free_slot) return npos;
+            if (m_slots[i].id == id) return m_slots[i].index;
+        }
+    }
+
+    void Set(uint32_t id, uint32_t index) {
+        if ((m_size+1)*4 > m_slots.size()*3) Grow();
+        size_t i = Hash(id) & Mask();
+        while (m_slots[i].index != free_slot && m_slots[i].id != id) i = (i+1) & Mask();
+        if (m_slots[i].index == free_slot) m_size++;
+        m_slots[i] = Slot{id, index};
+    }
+
+    void Erase(uint32_t id) {
+        size_t i = Hash(id) & Mask();
+        while (m_slots[i].id != id || m_slots[i].index == free_slot) {
+            if (m_slots[i].index == free_slot) return;
+            i = (i+1) & Mask();
+        }
+        // backward shift deletion keeps probe chains intact without tombstones
+        for (size_t j = (i+1) & Mask(); m_slots[j].index != free_slot; j = (j+1) & Mask()) {
+            size_t home = Hash(m_slots[j].id) & Mask();
+            if (((j - home) & Mask()) >= ((j - i) & Mask())) {
+                m_slots[i] = m_slots[j];
+                i = j;
+            }
+        }
+        m_slots[i].index = free_slot;
+        m_size--;
+    }
+
+    void Clear() {
+        for (Slot& slot : m_slots) slot.index = free_slot;
+        m_size = 0;
+    }
+};
+
+// structure of arrays, so the per-tick physics runs over contiguous floats.
+// removal swaps the last player into the hole, only that player's index changes
+class PlayerStorage {
+private:
+    std::vector<uint32_t> m_ids;
+    std::vector<float> m_pos_x;
+    std::vector<float> m_pos_y;
+    std::vector<float> m_vel_x;
+    std::vector<float> m_vel_y;
+    IdIndexMap m_index;
+
+public:
+    static constexpr uint32_t npos = IdIndexMap::npos;
+
+    size_t Size() const { return m_ids.size(); }
+    bool Empty() const { return m_ids.empty(); }
+
+    uint32_t Find(uint32_t id) const { return m_index.Find(id); }
+    bool Contains(uint32_t id) const { return Find(id) != npos; }
+
+    uint32_t IdAt(size_t index) const { return m_ids[index]; }
+
+    PlayerState At(size_t index) const {
+        return PlayerState{{m_pos_x[index], m_pos_y[index]}, {m_vel_x[index], m_vel_y[index]}};
+    }
+
+    void SetAt(size_t index, const PlayerState& player) {
+        m_pos_x[index] = player.position.x;
+        m_pos_y[index] = player.position.y;
+        m_vel_x[index] = player.velocity.x;
+        m_vel_y[index] = player.velocity.y;
+    }
+
+    // inserts or overwrites, returns the index
+    uint32_t Set(uint32_t id, const PlayerState& player) {
+        uint32_t index = Find(id);
+        if (index == npos) {
+            index = m_ids.size();
+            m_ids.push_back(id);
+            m_pos_x.push_back(0);
+            m_pos_y.push_back(0);
+            m_vel_x.push_back(0);
+            m_vel_y.push_back(0);
+            m_index.Set(id, index);
+        }
+        SetAt(index, player);
+        return index;
+    }
+
+    bool Remove(uint32_t id) {
+        uint32_t index = Find(id);
+        if (index == npos) return false;
+
+        size_t last = m_ids.size()-1;
+        if (index != last) {
+            m_ids[index] = m_ids[last];
+            m_pos_x[index] = m_pos_x[last];
+            m_pos_y[index] = m_pos_y[last];
+            m_vel_x[index] = m_vel_x[last];
+            m_vel_y[index] = m_vel_y[last];
+            m_index.Set(m_ids[index], index);
+        }
+        m_ids.pop_back();
+        m_pos_x.pop_back();
+        m_pos_y.pop_back();
+        m_vel_x.pop_back();
+        m_vel_y.pop_back();
+        m_index.Erase(id);
+        return true;
+    }
+
+    void Clear() {
+        m_ids.clear();
+        m_pos_x.clear();
+        m_pos_y.clear();
+        m_vel_x.clear();
+        m_vel_y.clear();
+        m_index.Clear();
+    }
+
+    float* PositionsX() { return m_pos_x.data(); }
+    float* PositionsY() { return m_pos_y.data(); }
+    float* VelocitiesX() { return m_vel_x.data(); }
+    float* VelocitiesY() { return m_vel_y.data(); }
+    const float* PositionsX() const { return m_pos_x.data(); }
+    const float* PositionsY() const { return m_pos_y.data(); }
+    const float* VelocitiesX() const { return m_vel_x.data(); }
+    const float* VelocitiesY() const { return m_vel_y.data(); }
+};
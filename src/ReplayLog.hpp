@@ -0,0 +1,369 @@
+#pragma once
+#include "ByteStream.hpp"
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// append-only binary match recording.
+// file: header, records, and when closed cleanly an index record plus trailer.
+//   header:  magic, version, ticks per second
+//   record:  type u8, tick u32, payload length u32, payload
+//   trailer: offset of the index record u32 x2 (low, high), trailer magic
+// a file without trailer (crash, still being written) is read by scanning the records
+
+constexpr uint32_t replay_magic = 0x59504C52;         // "RLPY"
+constexpr uint32_t replay_trailer_magic = 0x58444952; // "RIDX"
+constexpr uint32_t replay_version = 2;
+constexpr size_t replay_header_size = 12;
+constexpr size_t replay_record_header_size = 9;
+constexpr size_t replay_trailer_size = 12;
+constexpr size_t replay_spare_buffers = 4; // written buffers kept for reuse by Flush
+
+enum ReplayRecordType : uint8_t {
+    REPLAY_KEYFRAME = 1, // tick: state tick, payload: full state at the start of tick
+    REPLAY_EVENTS,       // tick: first tick, payload: events of a contiguous range of ticks
+    REPLAY_INDEX,        // payload: keyframe count, then per keyframe: tick, offset low, offset high
+    REPLAY_CHECKSUM,     // tick: state tick, payload: Game::Checksum of the state at the start of tick, low, high
+};
+
+struct ReplayKeyframeEntry {
+    uint32_t tick;
+    uint64_t offset;
+};
+
+// buffers records on the simulation thread and hands them to a background thread in one
+// piece per Flush. at most max_buffered_bytes wait for the disk, past that a flush is dropped
+// and events are refused until the next keyframe, so the file only ever has whole, restartable gaps.
+// one writer records a series of files: Open starts the next one, Finish ends the current one.
+// the thread writes, finishes and closes them, the simulation never waits for the disk
+class ReplayWriter {
+private:
+    // a piece of a file, the last one of a file closes it
+    struct Chunk {
+        std::FILE* file = nullptr;
+        std::vector<uint8_t> bytes;
+        bool close = false;
+    };
+
+    uint32_t m_ticks_per_second;
+    size_t m_max_buffered_bytes;
+
+    // simulation thread
+    std::FILE* m_file = nullptr;
+    std::vector<uint8_t> m_pending;
+    std::vector<ReplayKeyframeEntry> m_pending_index;
+    std::vector<ReplayKeyframeEntry> m_index;
+    uint64_t m_accepted_bytes = 0; // file offset the next accepted flush starts at
+    bool m_gap = false;
+    uint64_t m_dropped_flushes = 0;
+
+    // shared with the writer thread
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::vector<Chunk> m_queue;
+    std::vector<std::vector<uint8_t>> m_spares; // written and cleared, capacity kept
+    size_t m_queued_bytes = 0;
+    bool m_closing = false;
+    std::thread m_thread;
+
+    void Run() {
+        std::vector<Chunk> batch;
+        std::unique_lock lock(m_mutex);
+        while (true) {
+            m_wake.wait(lock, [this](){ return m_closing || !m_queue.empty(); });
+            if (m_queue.empty()) break;
+            batch.swap(m_queue);
+            lock.unlock();
+            for (Chunk& chunk : batch) {
+                std::fwrite(chunk.bytes.data(), 1, chunk.bytes.size(), chunk.file);
+                if (chunk.close) std::fclose(chunk.file);
+            }
+            if (!batch.back().close) std::fflush(batch.back().file);
+            lock.lock();
+            for (Chunk& chunk : batch) {
+                m_queued_bytes -= chunk.bytes.size();
+                chunk.bytes.clear();
+                if (m_spares.size() < replay_spare_buffers) m_spares.push_back(std::move(chunk.bytes));
+            }
+            batch.clear();
+        }
+    }
+
+    void BeginRecord(ReplayRecordType type, uint32_t tick, size_t payload_size) {
+        ByteWriter writer(m_pending);
+        writer.WriteU8(type);
+        writer.WriteU32(tick);
+        writer.WriteU32(payload_size);
+    }
+
+    // on success bytes is replaced by a spare buffer when there is one
+    bool Enqueue(std::vector<uint8_t>& bytes, bool force, bool close = false) {
+        {
+        std::lock_guard lock(m_mutex);
+        if (!force && m_queued_bytes + bytes.size() > m_max_buffered_bytes) return false;
+        m_queued_bytes += bytes.size();
+        m_queue.push_back({m_file, std::move(bytes), close});
+        bytes.clear();
+        if (!m_spares.empty()) {
+            bytes = std::move(m_spares.back());
+            m_spares.pop_back();
+        }
+        }
+        m_wake.notify_one();
+        return true;
+    }
+
+public:
+    ReplayWriter(uint32_t ticks_per_second, size_t max_buffered_bytes = 8 << 20)
+        : m_ticks_per_second(ticks_per_second), m_max_buffered_bytes(max_buffered_bytes) {
+        m_spares.reserve(replay_spare_buffers);
+        m_thread = std::thread([this](){ Run(); });
+    }
+
+    ~ReplayWriter() {
+        Finish();
+        {
+        std::lock_guard lock(m_mutex);
+        m_closing = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    ReplayWriter(const ReplayWriter&) = delete;
+    ReplayWriter& operator=(const ReplayWriter&) = delete;
+
+    // finishes the current file and starts recording to path, which is overwritten.
+    // nothing but a keyframe is taken until the first one
+    bool Open(const std::string& path) {
+        Finish();
+        m_file = std::fopen(path.c_str(), "wb");
+        if (!m_file) return false;
+
+        m_index.clear();
+        m_gap = true;
+        ByteWriter writer(m_pending);
+        writer.WriteU32(replay_magic);
+        writer.WriteU32(replay_version);
+        writer.WriteU32(m_ticks_per_second);
+        Enqueue(m_pending, true);
+        m_accepted_bytes = replay_header_size;
+        m_pending.clear();
+        return true;
+    }
+
+    bool IsOpen() const { return m_file != nullptr; }
+
+    // bytes handed to the writer thread for the current file
+    uint64_t Size() const { return m_accepted_bytes; }
+
+    void AddKeyframe(uint32_t tick, const std::vector<uint8_t>& state_bytes) {
+        if (!m_file) return;
+        m_pending_index.push_back({tick, m_accepted_bytes + m_pending.size()});
+        BeginRecord(REPLAY_KEYFRAME, tick, state_bytes.size());
+        m_pending.insert(m_pending.end(), state_bytes.begin(), state_bytes.end());
+        m_gap = false;
+    }
+
+    void AddEvents(uint32_t first_tick, const std::vector<uint8_t>& event_bytes) {
+        if (!m_file || m_gap) return;
+        BeginRecord(REPLAY_EVENTS, first_tick, event_bytes.size());
+        m_pending.insert(m_pending.end(), event_bytes.begin(), event_bytes.end());
+    }
+
+    void AddChecksum(uint32_t tick, uint64_t checksum) {
+        if (!m_file || m_gap) return;
+        BeginRecord(REPLAY_CHECKSUM, tick, 8);
+        ByteWriter writer(m_pending);
+        writer.WriteU32(uint32_t(checksum));
+        writer.WriteU32(uint32_t(checksum >> 32));
+    }
+
+    // a recording that dropped data, or a new file, starts at its next keyframe
+    bool NeedsKeyframe() const { return m_gap; }
+
+    // hands everything added since the last call to the writer thread
+    void Flush() {
+        if (!m_file || m_pending.empty()) return;
+        size_t size = m_pending.size();
+        if (Enqueue(m_pending, false)) {
+            m_accepted_bytes += size;
+            m_index.insert(m_index.end(), m_pending_index.begin(), m_pending_index.end());
+        }
+        else {
+            m_gap = true;
+            m_dropped_flushes++;
+        }
+        m_pending.clear();
+        m_pending_index.clear();
+    }
+
+    // ends the current file with the index and trailer. the writer thread closes it
+    void Finish() {
+        if (!m_file) return;
+        Flush();
+
+        std::vector<uint8_t> payload;
+        ByteWriter index_writer(payload);
+        index_writer.WriteVarU32(m_index.size());
+        for (const ReplayKeyframeEntry& entry : m_index) {
+            index_writer.WriteU32(entry.tick);
+            index_writer.WriteU32(uint32_t(entry.offset));
+            index_writer.WriteU32(uint32_t(entry.offset >> 32));
+        }
+        uint64_t index_offset = m_accepted_bytes;
+        BeginRecord(REPLAY_INDEX, 0, payload.size());
+        m_pending.insert(m_pending.end(), payload.begin(), payload.end());
+        ByteWriter writer(m_pending);
+        writer.WriteU32(uint32_t(index_offset));
+        writer.WriteU32(uint32_t(index_offset >> 32));
+        writer.WriteU32(replay_trailer_magic);
+        Enqueue(m_pending, true, true);
+        m_pending.clear();
+        m_file = nullptr;
+    }
+
+    uint64_t DroppedFlushes() const { return m_dropped_flushes; }
+};
+
+struct ReplayRecord {
+    ReplayRecordType type;
+    uint32_t tick;
+    const uint8_t* payload;
+    uint32_t size;
+    uint64_t offset;
+    uint64_t next_offset;
+};
+
+// read-only view of a replay file, memory mapped so opening is instant whatever the length
+class ReplayReader {
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    uint32_t m_ticks_per_second = 0;
+    std::vector<ReplayKeyframeEntry> m_index;
+    bool m_complete = false; // had a trailer
+
+#if defined(_WIN32)
+    std::vector<uint8_t> m_bytes;
+#endif
+
+    bool ReadIndex() {
+        if (m_size < replay_header_size + replay_trailer_size) return false;
+        ByteReader trailer(m_data + m_size - replay_trailer_size, replay_trailer_size);
+        uint64_t offset = trailer.ReadU32();
+        offset |= uint64_t(trailer.ReadU32()) << 32;
+        if (trailer.ReadU32() != replay_trailer_magic) return false;
+
+        ReplayRecord record;
+        if (!RecordAt(offset, record) || record.type != REPLAY_INDEX) return false;
+        ByteReader reader(record.payload, record.size);
+        uint32_t count = reader.ReadVarU32();
+        for (uint32_t i = 0; i < count && reader.Ok(); i++) {
+            ReplayKeyframeEntry entry;
+            entry.tick = reader.ReadU32();
+            entry.offset = reader.ReadU32();
+            entry.offset |= uint64_t(reader.ReadU32()) << 32;
+            if (reader.Ok()) m_index.push_back(entry);
+        }
+        return reader.Ok();
+    }
+
+    void ScanIndex() {
+        m_index.clear();
+        ReplayRecord record;
+        for (uint64_t offset = replay_header_size; RecordAt(offset, record); offset = record.next_offset) {
+            if (record.type == REPLAY_KEYFRAME) m_index.push_back({record.tick, record.offset});
+        }
+    }
+
+public:
+    ReplayReader(const std::string& path) {
+#if defined(_WIN32)
+        std::ifstream file(path, std::ios::binary);
+        m_bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        m_data = m_bytes.data();
+        m_size = m_bytes.size();
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                m_data = static_cast<const uint8_t*>(mapped);
+                m_size = st.st_size;
+            }
+        }
+        close(fd);
+#endif
+        if (m_size < replay_header_size) return;
+        ByteReader header(m_data, replay_header_size);
+        if (header.ReadU32() != replay_magic || header.ReadU32() != replay_version) {
+            m_size = 0;
+            return;
+        }
+        m_ticks_per_second = header.ReadU32();
+
+        m_complete = ReadIndex();
+        if (!m_complete) ScanIndex();
+    }
+
+    ~ReplayReader() {
+#if !defined(_WIN32)
+        if (m_data) munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    }
+
+    ReplayReader(const ReplayReader&) = delete;
+    ReplayReader& operator=(const ReplayReader&) = delete;
+
+    bool IsOpen() const { return m_size > 0; }
+    bool IsComplete() const { return m_complete; }
+    uint32_t TicksPerSecond() const { return m_ticks_per_second; }
+    const std::vector<ReplayKeyframeEntry>& Keyframes() const { return m_index; }
+    uint64_t FirstRecordOffset() const { return replay_header_size; }
+
+    // false past the last whole record
+    bool RecordAt(uint64_t offset, ReplayRecord& record) const {
+        if (offset + replay_record_header_size > m_size) return false;
+        ByteReader reader(m_data + offset, replay_record_header_size);
+        record.type = ReplayRecordType(reader.ReadU8());
+        record.tick = reader.ReadU32();
+        record.size = reader.ReadU32();
+        record.offset = offset;
+        record.payload = m_data + offset + replay_record_header_size;
+        record.next_offset = offset + replay_record_header_size + record.size;
+        if (record.next_offset > m_size) return false;
+        return record.type >= REPLAY_KEYFRAME && record.type <= REPLAY_CHECKSUM;
+    }
+
+    static uint64_t ReadChecksum(const ReplayRecord& record) {
+        ByteReader reader(record.payload, record.size);
+        uint64_t checksum = reader.ReadU32();
+        return checksum | uint64_t(reader.ReadU32()) << 32;
+    }
+
+    // newest keyframe at or before tick, binary search over the index
+    const ReplayKeyframeEntry* KeyframeBefore(uint32_t tick) const {
+        size_t low = 0, high = m_index.size();
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (m_index[mid].tick <= tick) low = mid + 1;
+            else high = mid;
+        }
+        return low > 0 ? &m_index[low-1] : nullptr;
+    }
+};
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <EasyNet/EasyNetServer.hpp>
+#include "shared.hpp"
+#include "SpscQueue.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+constexpr size_t net_queue_capacity = 1 << 14;
+constexpr auto net_poll_interval = std::chrono::milliseconds(1);
+constexpr auto link_stats_interval = std::chrono::milliseconds(250); // how often rooms hear about their peers' links
+constexpr double egress_burst_seconds = 0.1; // the egress bucket holds this much of the budget
+constexpr uint32_t room_capacity = 64; // a room fills up to this before new peers go to the next one
+
+enum NetInboundType {
+    NET_CONNECT = 0,
+    NET_DISCONNECT,
+    NET_PLAYER_INPUT,
+    NET_SNAPSHOT_ACK,
+    NET_LINK_STATS,
+    NET_INPUT_HORIZON,
+    NET_TIME_SYNC,
+};
+
+// what ENet and the network thread know about a peer's link
+struct PeerLinkStats {
+    uint32_t rtt_ms = 0;
+    uint32_t rtt_variance_ms = 0;
+    float packet_loss = 0;        // 0..1
+    float throttle = 0;           // 0..1, ENet's share of unreliable packets it still lets through
+    uint32_t sent_bytes_per_sec = 0; // everything queued for this peer over the last interval
+
+    // totals since the peer connected
+    uint64_t bytes_received = 0;
+    uint64_t packets_received = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t packets_sent = 0;
+    uint64_t snapshot_bytes = 0;   // part of bytes_sent
+    uint64_t snapshots_sent = 0;
+    uint64_t snapshots_dropped = 0; // over the egress budget
+};
+
+// a client's clock sync request, stamped when the network thread got it
+struct TimeSyncRequest {
+    double client_time = 0;
+    std::chrono::steady_clock::time_point received_at{};
+};
+
+// a decoded packet or connection change, network thread -> simulation.
+// built with only the fields its type uses, the rest stay default
+struct NetInbound {
+    NetInboundType type = NET_CONNECT;
+    uint32_t peer_id = 0;
+    uint32_t tick = 0;     // input tick, acked snapshot tick, or first tick the peer may still send inputs for
+    PlayerInput input{};
+    PeerLinkStats link{};
+    TimeSyncRequest sync{};
+};
+
+// a packet to send, simulation -> network thread. the message owns its packet: ENet may send and
+// free it at the next service, so one packet is never spread over several messages. a packet for
+// many peers is one broadcast message, sent to all of them in one go
+struct NetOutbound {
+    ENetPacket* packet = nullptr;
+    uint32_t peer_id = 0;
+    bool broadcast = false; // to every peer in the room
+    bool droppable = false; // may be dropped when over the egress budget
+};
+
+// input ticks a peer already delivered, batches repeat every input several times
+struct InputDedup {
+    bool any = false;
+    uint32_t newest_tick = 0;
+    uint64_t seen = 0; // bit i: newest_tick - i arrived
+
+    // true if the tick was delivered already. ticks 64 or more behind the newest count as delivered
+    bool Seen(uint32_t tick) const {
+        if (!any || tick > newest_tick) return false;
+        uint32_t age = newest_tick - tick;
+        return age >= 64 || (seen & (uint64_t(1) << age));
+    }
+
+    // only once the room has the input, a copy in a later batch may still deliver it otherwise
+    void Mark(uint32_t tick) {
+        if (!any || tick > newest_tick) {
+            uint32_t shift = any ? tick - newest_tick : 64;
+            seen = shift >= 64 ? 1 : (seen << shift) | 1;
+            newest_tick = tick;
+            any = true;
+            return;
+        }
+        uint32_t age = newest_tick - tick;
+        if (age < 64) seen |= uint64_t(1) << age;
+    }
+};
+
+struct PeerRoute {
+    uint32_t room = 0;
+    ENetPeer* peer = nullptr;
+    InputDedup inputs{};
+    uint32_t input_horizon = 0; // every input before this tick was sent
+    uint64_t sent_bytes = 0; // since the last link stats
+    PeerLinkStats link{};    // the totals, SendLinkStats fills in the rest
+};
+
+// one room's queues to and from the network thread. the room side is used by whichever worker
+// runs the room's tick, the pool orders those so there is still one consumer and one producer.
+// snapshots come from the room's encoder thread, so they get a queue of their own
+class RoomLink {
+private:
+    friend class ServerNetwork;
+    SpscQueue<NetInbound> m_inbound{net_queue_capacity};
+    SpscQueue<NetOutbound> m_outbound{net_queue_capacity};
+    SpscQueue<NetOutbound> m_snapshots{net_queue_capacity};
+
+public:
+    bool Poll(NetInbound& message) { return m_inbound.TryPop(message); }
+
+    // takes ownership of packet, it must not be queued again.
+    // droppable packets are the first to go when the server is over its egress budget
+    void Send(uint32_t peer_id, ENetPacket* packet, bool droppable = false) {
+        NetOutbound message{packet, peer_id, false, droppable};
+        while (!m_outbound.TryPush(message)) std::this_thread::yield();
+    }
+
+    void Broadcast(ENetPacket* packet) {
+        NetOutbound message{packet, 0, true, false};
+        while (!m_outbound.TryPush(message)) std::this_thread::yield();
+    }
+
+    // encoder thread only, droppable like any snapshot
+    void SendSnapshot(uint32_t peer_id, ENetPacket* packet) {
+        NetOutbound message{packet, peer_id, false, true};
+        while (!m_snapshots.TryPush(message)) std::this_thread::yield();
+    }
+};
+
+// services ENet on its own thread, so packet bursts don't eat into the tick budget.
+// everything that touches the ENet host happens on that thread, including routing peers to rooms
+class ServerNetwork {
+private:
+    std::shared_ptr<EasyNetServer> m_server;
+    std::vector<std::unique_ptr<RoomLink>> m_rooms;
+
+    // network thread only
+    std::map<uint32_t, PeerRoute> m_peer_rooms;
+    std::vector<std::set<uint32_t>> m_room_peers;
+    InputBatch m_batch; // reused for decoding
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+    std::atomic<uint64_t> m_dropped_inputs{0};
+
+    // global egress token bucket, 0 bytes per second is unlimited
+    double m_egress_bytes_per_sec;
+    double m_egress_tokens = 0;
+    std::chrono::steady_clock::time_point m_egress_refill;
+    std::chrono::steady_clock::time_point m_next_link_stats;
+    uint32_t m_first_room = 0; // rotates, so no room always gets the budget that's left over
+    std::atomic<uint64_t> m_dropped_packets{0};
+
+    // connection changes must not get lost, inputs are dropped when the room is that far behind
+    // false if droppable and dropped
+    bool PushInbound(uint32_t room, const NetInbound& message, bool droppable) {
+        while (!m_rooms[room]->m_inbound.TryPush(message)) {
+            if (droppable) {
+                m_dropped_inputs.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    // new peers join the first room with space, so players meet in one match until it's full.
+    // when every room is full, the emptiest one
+    uint32_t PickRoom() const {
+        uint32_t emptiest = 0;
+        for (uint32_t room = 0; room < m_room_peers.size(); room++) {
+            if (m_room_peers[room].size() < room_capacity) return room;
+            if (m_room_peers[room].size() < m_room_peers[emptiest].size()) emptiest = room;
+        }
+        return emptiest;
+    }
+
+    void OnConnect(ENetEvent event) {
+        uint32_t id = enet_peer_get_id(event.peer);
+        uint32_t room = PickRoom();
+        m_peer_rooms[id] = PeerRoute{room, event.peer};
+        m_room_peers[room].insert(id);
+        PushInbound(room, NetInbound{NET_CONNECT, id}, false);
+    }
+
+    void OnDisconnect(ENetEvent event) {
+        uint32_t id = enet_peer_get_id(event.peer);
+        auto it = m_peer_rooms.find(id);
+        if (it == m_peer_rooms.end()) return;
+        m_room_peers[it->second.room].erase(id);
+        PushInbound(it->second.room, NetInbound{NET_DISCONNECT, id}, false);
+        m_peer_rooms.erase(it);
+    }
+
+    void OnRecieve(ENetEvent event) {
+        uint32_t id = enet_peer_get_id(event.peer);
+        auto it = m_peer_rooms.find(id);
+        if (it == m_peer_rooms.end()) return;
+        uint32_t room = it->second.room;
+        it->second.link.bytes_received += event.packet->dataLength;
+        it->second.link.packets_received++;
+        if (event.packet->dataLength < sizeof(MessageType)) return;
+
+        MessageType msgType = ExtractMessageType(event.packet);
+        switch (msgType) {
+        case MSG_PLAYER_INPUT:
+            if (ExtractInputBatch(event.packet, m_batch)) {
+                // a dropped input holds the horizon back, so the room doesn't commit past it
+                // before a repeat in a later batch gets through
+                uint32_t horizon = m_batch.newest_tick + 1;
+                for (auto& [tick, input] : m_batch.inputs) {
+                    if (it->second.inputs.Seen(tick)) continue;
+                    if (PushInbound(room, NetInbound{NET_PLAYER_INPUT, id, tick, input}, true)) it->second.inputs.Mark(tick);
+                    else horizon = std::min(horizon, tick);
+                }
+                // after the inputs it covers, so the room never commits a tick before seeing them
+                if (horizon > it->second.input_horizon) {
+                    if (PushInbound(room, NetInbound{NET_INPUT_HORIZON, id, horizon}, true)) it->second.input_horizon = horizon;
+                }
+            }
+            break;
+
+        case MSG_SNAPSHOT_ACK:
+            if (HasData<uint32_t>(event.packet)) PushInbound(room, NetInbound{NET_SNAPSHOT_ACK, id, ExtractData<uint32_t>(event.packet)}, true);
+            break;
+
+        case MSG_TIME_SYNC_REQUEST:
+            if (HasData<TimeSyncRequestPacketData>(event.packet)) {
+                NetInbound message{NET_TIME_SYNC, id};
+                message.sync.client_time = ExtractData<TimeSyncRequestPacketData>(event.packet).client_time;
+                message.sync.received_at = std::chrono::steady_clock::now();
+                PushInbound(room, message, true);
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void RefillEgress() {
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - m_egress_refill).count();
+        m_egress_refill = now;
+        m_egress_tokens = std::min(m_egress_tokens + elapsed * m_egress_bytes_per_sec, m_egress_bytes_per_sec * egress_burst_seconds);
+    }
+
+    // droppable packets need the tokens, everything else is sent regardless and only runs the bucket into debt
+    bool TakeEgress(const NetOutbound& message, size_t bytes) {
+        if (m_egress_bytes_per_sec <= 0) return true;
+        if (message.droppable && m_egress_tokens < double(bytes)) return false;
+        m_egress_tokens -= double(bytes);
+        return true;
+    }
+
+    void SendTo(uint32_t id, PeerRoute& route, ENetPacket* packet, bool snapshot) {
+        m_server->SendTo(id, packet);
+        route.sent_bytes += packet->dataLength;
+        route.link.bytes_sent += packet->dataLength;
+        route.link.packets_sent++;
+        if (snapshot) {
+            route.link.snapshot_bytes += packet->dataLength;
+            route.link.snapshots_sent++;
+        }
+    }
+
+    void SendOutbound(uint32_t room, NetOutbound& message, bool snapshot) {
+        if (message.broadcast) {
+            if (TakeEgress(message, message.packet->dataLength * m_room_peers[room].size())) {
+                for (uint32_t id : m_room_peers[room]) SendTo(id, m_peer_rooms[id], message.packet, snapshot);
+            }
+            else m_dropped_packets.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (auto it = m_peer_rooms.find(message.peer_id); it != m_peer_rooms.end()) {
+            if (TakeEgress(message, message.packet->dataLength)) SendTo(message.peer_id, it->second, message.packet, snapshot);
+            else {
+                m_dropped_packets.fetch_add(1, std::memory_order_relaxed);
+                if (snapshot) it->second.link.snapshots_dropped++;
+            }
+        }
+        // nothing between the sends above and here services ENet, so the packet is still alive
+        if (message.packet->referenceCount == 0) enet_packet_destroy(message.packet);
+    }
+
+    void SendOutbound() {
+        RefillEgress();
+        NetOutbound message;
+        for (uint32_t i = 0; i < m_rooms.size(); i++) {
+            uint32_t room = (m_first_room + i) % m_rooms.size();
+            while (m_rooms[room]->m_outbound.TryPop(message)) SendOutbound(room, message, false);
+            while (m_rooms[room]->m_snapshots.TryPop(message)) SendOutbound(room, message, true);
+        }
+        m_first_room = m_rooms.empty() ? 0 : (m_first_room + 1) % m_rooms.size();
+    }
+
+    void SendLinkStats() {
+        auto now = std::chrono::steady_clock::now();
+        if (now < m_next_link_stats) return;
+        double seconds = std::chrono::duration<double>(now - (m_next_link_stats - link_stats_interval)).count();
+        m_next_link_stats = now + link_stats_interval;
+
+        for (auto& [id, route] : m_peer_rooms) {
+            NetInbound message{NET_LINK_STATS, id};
+            message.link = route.link;
+            message.link.rtt_ms = route.peer->roundTripTime;
+            message.link.rtt_variance_ms = route.peer->roundTripTimeVariance;
+            message.link.packet_loss = float(route.peer->packetLoss) / ENET_PEER_PACKET_LOSS_SCALE;
+            message.link.throttle = float(route.peer->packetThrottle) / ENET_PEER_PACKET_THROTTLE_SCALE;
+            message.link.sent_bytes_per_sec = uint32_t(route.sent_bytes / seconds);
+            route.sent_bytes = 0;
+            PushInbound(route.room, message, true);
+        }
+    }
+
+    void Run() {
+        while (m_running.load(std::memory_order_relaxed)) {
+            SendOutbound();
+            m_server->Update();
+            SendLinkStats();
+            std::this_thread::sleep_for(net_poll_interval);
+        }
+        SendOutbound();
+        m_server->Update();
+    }
+
+public:
+    // egress_bytes_per_sec caps what all rooms send together, snapshots are dropped first
+    ServerNetwork(int port, uint32_t room_count, double egress_bytes_per_sec = 0)
+        : m_egress_bytes_per_sec(egress_bytes_per_sec) {
+        if (room_count == 0) room_count = 1;
+        for (uint32_t room = 0; room < room_count; room++) m_rooms.push_back(std::make_unique<RoomLink>());
+        m_room_peers.resize(room_count);
+
+        m_server = std::make_shared<EasyNetServer>();
+        m_server->CreateServer(port);
+
+        m_server->SetOnConnect([this](ENetEvent event){this->OnConnect(event);});
+        m_server->SetOnDisconnect([this](ENetEvent event){this->OnDisconnect(event);});
+        m_server->SetOnReceive([this](ENetEvent event){this->OnRecieve(event);});
+    }
+
+    ~ServerNetwork() { Stop(); }
+
+    void Start() {
+        m_running = true;
+        m_egress_refill = std::chrono::steady_clock::now();
+        m_next_link_stats = m_egress_refill + link_stats_interval;
+        m_thread = std::thread([this](){ Run(); });
+    }
+
+    void Stop() {
+        m_running = false;
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    RoomLink& Room(uint32_t room) { return *m_rooms[room]; }
+    uint32_t RoomCount() const { return m_rooms.size(); }
+
+    uint64_t DroppedInputs() const { return m_dropped_inputs.load(std::memory_order_relaxed); }
+    uint64_t DroppedPackets() const { return m_dropped_packets.load(std::memory_order_relaxed); }
+};
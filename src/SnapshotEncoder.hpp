@@ -0,0 +1,203 @@
+#pragma once
+
+#include "shared.hpp"
+#include "ServerNetwork.hpp"
+#include "SpatialGrid.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// interest management: a client only gets the players around its own
+constexpr float interest_cell_size = 250;
+constexpr float interest_near_radius = 1000;    // the whole 1000x1000 window, wherever the player is on it
+constexpr float interest_far_radius = 2000;     // sent at a lower rate
+constexpr uint32_t interest_far_period = 4;     // far players are refreshed every 4th snapshot
+constexpr uint32_t interest_max_players = 256;  // nearest ones win, bounds the snapshot size
+constexpr uint32_t interest_low_detail_max_players = 64; // slow links get near players only, and fewer
+
+constexpr bool compress_snapshots = true; // kept only when it actually shrinks the snapshot
+
+// what the room decided about one peer for one snapshot
+struct SnapshotPeer {
+    uint32_t id;
+    bool due;                 // false: only keeps the peer's baselines alive
+    bool low_detail;
+    uint32_t snapshot_number; // staggers the far player refreshes
+    bool has_ack;
+    uint32_t acked_tick;
+};
+
+// an immutable copy of the room's state and who gets a snapshot of it. peers must be sorted by id
+struct SnapshotJob {
+    uint32_t tick = 0;
+    GameState state;
+    std::vector<SnapshotPeer> peers;
+};
+
+// turns a room's states into per-peer snapshot packets on its own thread: interest, delta against
+// the peer's acked baseline, checksum, compression and packet creation. the room only copies its
+// state into a job and goes on with the next tick. one job waits at most, a newer one replaces it
+// and also covers the peers the replaced one was due for
+class SnapshotEncoder {
+private:
+    RoomLink& m_link;
+    bool m_compress;
+    bool m_quantize = quantize_snapshots;
+
+    // encoder thread only
+    SpatialGrid m_grid{interest_cell_size};
+    std::vector<std::pair<float, uint32_t>> m_candidates; // squared distance, index in the job's state
+    std::map<uint32_t, std::map<uint32_t, GameState>> m_sent_history; // per peer, the views it was sent by tick
+    SnapshotJob m_working;
+    GameState m_view;
+    SerializedGameState m_data;
+    DeltaScratch m_delta_scratch;
+    std::vector<uint8_t> m_compressed;
+    LzCompressor m_compressor;
+
+    // shared with the room
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    SnapshotJob m_pending;
+    bool m_has_pending = false;
+    bool m_stopping = false;
+    std::thread m_thread;
+
+    // the part of the state a client gets. far players not due for a refresh keep the
+    // state from baseline, so they cost nothing in the delta. low detail leaves them out
+    void BuildView(GameState& view, const GameState& state, const SnapshotPeer& peer, const GameState* baseline) {
+        const PlayerStorage& players = state.players;
+        uint32_t self = players.Find(peer.id);
+        Vector2 center = self != PlayerStorage::npos ? players.At(self).position : Game::InitNewPlayer(state, peer.id).position;
+
+        float radius = peer.low_detail ? interest_near_radius : interest_far_radius;
+        uint32_t max_players = peer.low_detail ? interest_low_detail_max_players : interest_max_players;
+        m_candidates.clear();
+        m_grid.Query(center.x, center.y, radius, [&](uint32_t other_id) {
+            uint32_t index = players.Find(other_id);
+            float dist2 = Vector2DistanceSqr(center, players.At(index).position);
+            if (dist2 <= radius*radius) m_candidates.push_back({dist2, index});
+        });
+        if (m_candidates.size() > max_players) {
+            std::nth_element(m_candidates.begin(), m_candidates.begin() + max_players, m_candidates.end());
+            m_candidates.resize(max_players);
+        }
+
+        view.players.Clear();
+        for (auto& [dist2, index] : m_candidates) {
+            uint32_t other_id = players.IdAt(index);
+            bool far = dist2 > interest_near_radius*interest_near_radius;
+            if (far && baseline && (peer.snapshot_number + other_id) % interest_far_period != 0) {
+                uint32_t base_index = baseline->players.Find(other_id);
+                if (base_index != PlayerStorage::npos) {
+                    view.players.Set(other_id, baseline->players.At(base_index));
+                    continue;
+                }
+            }
+            view.players.Set(other_id, players.At(index));
+        }
+    }
+
+    void EncodeFor(const SnapshotPeer& peer, uint32_t tick, const GameState& state, std::map<uint32_t, GameState>& history) {
+        // clients without a usable baseline (new, or lost packets for too long) get a full snapshot
+        auto baseline = peer.has_ack ? history.find(peer.acked_tick) : history.end();
+        bool full = baseline == history.end() || baseline->first == tick;
+
+        BuildView(m_view, state, peer, full ? nullptr : &baseline->second);
+        if (full) Game::SerializeInto(m_data, m_view, m_quantize);
+        else Game::SerializeDeltaInto(m_data, baseline->second, m_view, m_quantize, m_delta_scratch);
+        m_data.tick = tick;
+        m_data.baseline_tick = full ? tick : baseline->first;
+        m_data.checksum = Game::FoldChecksum(Game::Checksum(m_view, m_quantize));
+        m_data.self_checksum = Game::FoldChecksum(Game::PlayerChecksum(state, peer.id));
+
+        // the oldest view's map node and storage take the new one, m_view gets the old storage back
+        auto node = history.size() >= snapshot_history_len ? history.extract(history.begin()) : std::map<uint32_t, GameState>::node_type{};
+        if (node) {
+            node.key() = tick;
+            std::swap(node.mapped(), m_view);
+            history.insert(std::move(node));
+        }
+        else std::swap(history[tick], m_view);
+
+        if (m_compress && m_data.bytes.size() > 1) {
+            m_compressed.clear();
+            m_compressed.push_back(m_data.bytes[0] | SNAPSHOT_COMPRESSED);
+            m_compressor.Compress(m_data.bytes.data() + 1, m_data.bytes.size() - 1, m_compressed);
+            if (m_compressed.size() < m_data.bytes.size()) m_data.bytes.swap(m_compressed);
+        }
+        m_link.SendSnapshot(peer.id, CreateSnapshotPacket(MSG_GAME_STATE, m_data, ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT));
+    }
+
+    void Encode(const SnapshotJob& job) {
+        m_grid.Update(job.state.players);
+
+        // both sorted by id: histories of peers the room no longer lists are dropped on the way
+        auto history = m_sent_history.begin();
+        for (const SnapshotPeer& peer : job.peers) {
+            while (history != m_sent_history.end() && history->first < peer.id) history = m_sent_history.erase(history);
+            if (history == m_sent_history.end() || history->first != peer.id) history = m_sent_history.try_emplace(history, peer.id);
+            if (peer.due) EncodeFor(peer, job.tick, job.state, history->second);
+            history++;
+        }
+        m_sent_history.erase(history, m_sent_history.end());
+    }
+
+    void Run() {
+        std::unique_lock lock(m_mutex);
+        while (true) {
+            m_wake.wait(lock, [this](){ return m_stopping || m_has_pending; });
+            if (!m_has_pending) break;
+            std::swap(m_working, m_pending);
+            m_has_pending = false;
+            lock.unlock();
+            Encode(m_working);
+            lock.lock();
+        }
+    }
+
+public:
+    SnapshotEncoder(RoomLink& link, bool compress = compress_snapshots) : m_link(link), m_compress(compress) {
+        m_thread = std::thread([this](){ Run(); });
+    }
+
+    ~SnapshotEncoder() {
+        {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    SnapshotEncoder(const SnapshotEncoder&) = delete;
+    SnapshotEncoder& operator=(const SnapshotEncoder&) = delete;
+
+    // peers the replaced job was due for get the newer one's state instead
+    static void MergeDue(SnapshotJob& newer, const SnapshotJob& older) {
+        auto it = newer.peers.begin();
+        for (const SnapshotPeer& peer : older.peers) {
+            if (!peer.due) continue;
+            while (it != newer.peers.end() && it->id < peer.id) it++;
+            if (it != newer.peers.end() && it->id == peer.id) it->due = true;
+        }
+    }
+
+    // hands job to the encoder thread. job comes back holding storage to fill next time.
+    // true if it replaced a job the encoder hadn't started, job then holds that one
+    bool Submit(SnapshotJob& job) {
+        bool replaced;
+        {
+        std::lock_guard lock(m_mutex);
+        replaced = m_has_pending;
+        std::swap(m_pending, job);
+        if (replaced) MergeDue(m_pending, job);
+        m_has_pending = true;
+        }
+        m_wake.notify_one();
+        return replaced;
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+#include "PlayerStorage.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// uniform grid of player ids by position. Update only touches players that changed cell,
+// so keeping it current costs one hash lookup per player. cells that empty out are kept
+// (up to a multiple of the player count) so players walking back and forth don't allocate
+class SpatialGrid {
+private:
+    struct Entry {
+        uint64_t cell;
+        uint32_t slot;  // index in the cell's id list
+        uint32_t stamp; // last Update that saw the player
+    };
+
+    float m_cell_size;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> m_cells;
+    std::unordered_map<uint32_t, Entry> m_entries;
+    uint32_t m_stamp = 0;
+
+    static constexpr float max_coord = 1 << 30;
+    static constexpr size_t empty_cells_per_player = 4; // past this many cells per player, empty ones are dropped
+
+    int32_t CellCoord(float value) const {
+        float cell = std::floor(value / m_cell_size);
+        if (!(cell > -max_coord)) return int32_t(-max_coord); // also catches NaN
+        if (cell > max_coord) return int32_t(max_coord);
+        return int32_t(cell);
+    }
+
+    static uint64_t Key(int32_t cx, int32_t cy) {
+        return (uint64_t(uint32_t(cx)) << 32) | uint32_t(cy);
+    }
+
+    void Insert(uint32_t id, uint64_t cell) {
+        std::vector<uint32_t>& ids = m_cells[cell];
+        m_entries[id] = Entry{cell, uint32_t(ids.size()), m_stamp};
+        ids.push_back(id);
+    }
+
+    void Erase(const Entry& entry) {
+        auto cell = m_cells.find(entry.cell);
+        std::vector<uint32_t>& ids = cell->second;
+        m_entries[ids.back()].slot = entry.slot;
+        ids[entry.slot] = ids.back();
+        ids.pop_back();
+    }
+
+    void DropEmptyCells() {
+        for (auto it = m_cells.begin(); it != m_cells.end();) {
+            if (it->second.empty()) it = m_cells.erase(it);
+            else it++;
+        }
+    }
+
+public:
+    SpatialGrid(float cell_size) : m_cell_size(cell_size) {}
+
+    void Update(const PlayerStorage& players) {
+        m_stamp++;
+        const float* xs = players.PositionsX();
+        const float* ys = players.PositionsY();
+        for (size_t i = 0; i < players.Size(); i++) {
+            uint32_t id = players.IdAt(i);
+            uint64_t cell = Key(CellCoord(xs[i]), CellCoord(ys[i]));
+            auto it = m_entries.find(id);
+            if (it == m_entries.end()) {
+                Insert(id, cell);
+                continue;
+            }
+            it->second.stamp = m_stamp;
+            if (it->second.cell != cell) {
+                Erase(it->second);
+                Insert(id, cell);
+            }
+        }
+
+        // players that left
+        if (m_entries.size() != players.Size()) {
+            for (auto it = m_entries.begin(); it != m_entries.end();) {
+                if (it->second.stamp != m_stamp) {
+                    Erase(it->second);
+                    it = m_entries.erase(it);
+                }
+                else it++;
+            }
+        }
+        if (m_cells.size() > empty_cells_per_player * (m_entries.size() + 1)) DropEmptyCells();
+    }
+
+    // calls f(id) for every player in a cell touching the square around center,
+    // the caller does the exact distance test
+    template<typename F>
+    void Query(float x, float y, float radius, F&& f) const {
+        int32_t min_x = CellCoord(x - radius), max_x = CellCoord(x + radius);
+        int32_t min_y = CellCoord(y - radius), max_y = CellCoord(y + radius);
+        for (int32_t cx = min_x; cx <= max_x; cx++) {
+            for (int32_t cy = min_y; cy <= max_y; cy++) {
+                auto cell = m_cells.find(Key(cx, cy));
+                if (cell == m_cells.end()) continue;
+                for (uint32_t id : cell->second) f(id);
+            }
+        }
+    }
+
+    size_t Size() const { return m_entries.size(); }
+};
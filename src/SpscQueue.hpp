@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// bounded lock-free queue for exactly one producer thread and one consumer thread.
+// capacity is rounded up to a power of two
+template<typename T>
+class SpscQueue {
+private:
+    static constexpr size_t cache_line = 64;
+
+    std::vector<T> m_items;
+    size_t m_mask;
+
+    // each index is written by one side only, keep them on separate cache lines
+    alignas(cache_line) std::atomic<size_t> m_head{0}; // next slot to read, owned by the consumer
+    alignas(cache_line) size_t m_cached_tail = 0;      // consumer's last view of m_tail
+    alignas(cache_line) std::atomic<size_t> m_tail{0}; // next slot to write, owned by the producer
+    alignas(cache_line) size_t m_cached_head = 0;      // producer's last view of m_head
+
+public:
+    SpscQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        m_items.resize(size);
+        m_mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer side, false when full
+    bool TryPush(const T& item) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cached_head > m_mask) {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (tail - m_cached_head > m_mask) return false;
+        }
+        m_items[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, false when empty
+    bool TryPop(T& item) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cached_tail) {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cached_tail) return false;
+        }
+        item = m_items[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t Capacity() const { return m_mask + 1; }
+};
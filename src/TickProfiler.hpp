@@ -0,0 +1,218 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+// log-linear histogram of durations: 8 buckets per power of two, ~12% resolution, fixed memory
+class LatencyHistogram {
+private:
+    static constexpr int sub_bits = 3;
+    static constexpr int sub_count = 1 << sub_bits;
+    static constexpr int bucket_count = (64 - sub_bits + 1) * sub_count;
+
+    std::array<uint32_t, bucket_count> m_buckets{};
+    uint64_t m_count = 0;
+    uint64_t m_max_ns = 0;
+
+    static int BucketOf(uint64_t ns) {
+        if (ns < sub_count) return int(ns);
+        int exp = std::bit_width(ns) - 1; // >= sub_bits
+        int sub = int(ns >> (exp - sub_bits)) & (sub_count - 1);
+        return (exp - sub_bits + 1) * sub_count + sub;
+    }
+
+    // middle of the bucket's range
+    static uint64_t ValueOf(int bucket) {
+        if (bucket < sub_count) return bucket;
+        int exp = bucket / sub_count + sub_bits - 1;
+        uint64_t low = (uint64_t(sub_count + bucket % sub_count)) << (exp - sub_bits);
+        return low + (uint64_t(1) << (exp - sub_bits)) / 2;
+    }
+
+public:
+    void Record(std::chrono::nanoseconds duration) {
+        uint64_t ns = duration.count() > 0 ? duration.count() : 0;
+        m_buckets[BucketOf(ns)]++;
+        m_count++;
+        if (ns > m_max_ns) m_max_ns = ns;
+    }
+
+    // fraction in [0, 1]
+    std::chrono::nanoseconds Percentile(double fraction) const {
+        if (m_count == 0) return {};
+        uint64_t rank = uint64_t(fraction * (m_count - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < bucket_count; i++) {
+            seen += m_buckets[i];
+            if (seen >= rank) return std::chrono::nanoseconds(std::min(ValueOf(i), m_max_ns));
+        }
+        return std::chrono::nanoseconds(m_max_ns);
+    }
+
+    std::chrono::nanoseconds Max() const { return std::chrono::nanoseconds(m_max_ns); }
+    uint64_t Count() const { return m_count; }
+
+    void Reset() {
+        m_buckets.fill(0);
+        m_count = 0;
+        m_max_ns = 0;
+    }
+};
+
+enum TickPhase {
+    PHASE_NETWORK = 0,  // servicing ENet, running the receive callbacks
+    PHASE_LATE_APPLY,   // advancing the late (committed) state
+    PHASE_APPLY,        // resimulating up to the broadcast tick
+    PHASE_SERIALIZE,    // encoding the replay, copying the state for the snapshot encoder
+    PHASE_BROADCAST,    // creating and queueing packets
+    PHASE_TOTAL,        // the whole Update
+    PHASE_COUNT
+};
+
+constexpr const char* tick_phase_names[PHASE_COUNT] = {
+    "network", "late_apply", "apply", "serialize", "broadcast", "total"
+};
+
+// one dump's worth of a TickProfiler, copied out so it can be written on another thread
+struct TickProfileWindow {
+    uint32_t tick = 0;
+    uint64_t ticks = 0;
+    std::chrono::steady_clock::duration budget{};
+    uint64_t overruns = 0;
+    uint64_t catchup_ticks = 0;
+    std::chrono::steady_clock::duration max_lag{};
+    uint64_t allocations = 0;
+    uint64_t allocating_ticks = 0;
+    uint64_t max_tick_allocations = 0;
+    std::array<LatencyHistogram, PHASE_COUNT> histograms;
+};
+
+// per-phase durations summed over one tick and fed into rolling histograms.
+// a phase only gets a sample on ticks it ran, so p50 of "serialize" is per broadcast, not per tick
+class TickProfiler {
+public:
+    using clock = std::chrono::steady_clock;
+
+private:
+    std::array<LatencyHistogram, PHASE_COUNT> m_histograms;
+    std::array<clock::duration, PHASE_COUNT> m_tick_sums{};
+    std::array<bool, PHASE_COUNT> m_ran{};
+    clock::time_point m_tick_start;
+
+    clock::duration m_budget;
+    uint64_t m_ticks = 0;
+    uint64_t m_overruns = 0;      // ticks whose Update took longer than the budget
+    uint64_t m_catchup_ticks = 0; // ticks run back to back because the loop fell behind
+    clock::duration m_max_lag{};
+
+    // heap allocations, see AllocationCounter.hpp
+    uint64_t m_allocations = 0;
+    uint64_t m_max_tick_allocations = 0;
+    uint64_t m_allocating_ticks = 0;
+
+public:
+    // adds the time from construction to destruction to a phase
+    class Scope {
+    private:
+        TickProfiler& m_profiler;
+        TickPhase m_phase;
+        clock::time_point m_start;
+
+    public:
+        Scope(TickProfiler& profiler, TickPhase phase) : m_profiler(profiler), m_phase(phase), m_start(clock::now()) {}
+        ~Scope() { m_profiler.Add(m_phase, clock::now() - m_start); }
+    };
+
+    TickProfiler(clock::duration budget) : m_budget(budget) {}
+
+    void BeginTick() {
+        m_tick_start = clock::now();
+        m_tick_sums.fill({});
+        m_ran.fill(false);
+    }
+
+    void Add(TickPhase phase, clock::duration duration) {
+        m_tick_sums[phase] += duration;
+        m_ran[phase] = true;
+    }
+
+    // returns the whole tick's duration
+    clock::duration EndTick() {
+        clock::duration total = clock::now() - m_tick_start;
+        Add(PHASE_TOTAL, total);
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            if (m_ran[phase]) m_histograms[phase].Record(m_tick_sums[phase]);
+        }
+        m_ticks++;
+        if (total > m_budget) m_overruns++;
+        return total;
+    }
+
+    // called by the main loop with how far behind schedule a tick started
+    void RecordLag(clock::duration lag) {
+        if (lag >= m_budget) m_catchup_ticks++;
+        if (lag > m_max_lag) m_max_lag = lag;
+    }
+
+    void RecordAllocations(uint64_t allocations) {
+        m_allocations += allocations;
+        if (allocations > m_max_tick_allocations) m_max_tick_allocations = allocations;
+        if (allocations > 0) m_allocating_ticks++;
+    }
+
+    // copies the current window into window and starts a new one. cheap, nothing is formatted
+    void TakeWindow(TickProfileWindow& window, uint32_t tick) {
+        window.tick = tick;
+        window.ticks = m_ticks;
+        window.budget = m_budget;
+        window.overruns = m_overruns;
+        window.catchup_ticks = m_catchup_ticks;
+        window.max_lag = m_max_lag;
+        window.allocations = m_allocations;
+        window.allocating_ticks = m_allocating_ticks;
+        window.max_tick_allocations = m_max_tick_allocations;
+        window.histograms = m_histograms;
+
+        for (LatencyHistogram& h : m_histograms) h.Reset();
+        m_ticks = 0;
+        m_overruns = 0;
+        m_catchup_ticks = 0;
+        m_max_lag = {};
+        m_allocations = 0;
+        m_max_tick_allocations = 0;
+        m_allocating_ticks = 0;
+    }
+
+    // overwrites path with window, meant for a DumpWriter's thread
+    static void Write(const std::string& path, const TickProfileWindow& window) {
+        using ms = std::chrono::duration<double, std::milli>;
+
+        std::string tmp_path = path + ".tmp";
+        {
+            std::ofstream file(tmp_path);
+            file << "tick " << window.tick << "\n";
+            file << "window_ticks " << window.ticks << "\n";
+            file << "budget_ms " << ms(window.budget).count() << "\n";
+            file << "overruns " << window.overruns << "\n";
+            file << "catchup_ticks " << window.catchup_ticks << "\n";
+            file << "max_lag_ms " << ms(window.max_lag).count() << "\n";
+            file << "allocations " << window.allocations << "\n";
+            file << "allocating_ticks " << window.allocating_ticks << "\n";
+            file << "max_tick_allocations " << window.max_tick_allocations << "\n";
+            file << "phase count p50_ms p99_ms max_ms\n";
+            for (int phase = 0; phase < PHASE_COUNT; phase++) {
+                const LatencyHistogram& h = window.histograms[phase];
+                file << tick_phase_names[phase] << " " << h.Count() << " "
+                     << ms(h.Percentile(0.5)).count() << " "
+                     << ms(h.Percentile(0.99)).count() << " "
+                     << ms(h.Max()).count() << "\n";
+            }
+        }
+        std::rename(tmp_path.c_str(), path.c_str()); // readers never see a half written file
+    }
+};
@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of threads running short tasks. every worker owns a deque, takes work from its back
+// and steals from the front of the others once its own runs dry, so one slow room doesn't leave
+// the tasks queued behind it waiting while other cores idle
+class WorkerPool {
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    size_t m_next_worker = 0;
+
+    std::atomic<size_t> m_queued{0};  // submitted, not yet taken by a worker
+    std::atomic<size_t> m_pending{0}; // submitted, not yet finished
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    bool m_stopping = false;
+
+    bool PopOwn(size_t index, std::function<void()>& task) {
+        Worker& worker = *m_workers[index];
+        std::lock_guard lock(worker.mutex);
+        if (worker.tasks.empty()) return false;
+        task = std::move(worker.tasks.back());
+        worker.tasks.pop_back();
+        return true;
+    }
+
+    bool Steal(size_t index, std::function<void()>& task) {
+        for (size_t i = 1; i < m_workers.size(); i++) {
+            Worker& victim = *m_workers[(index + i) % m_workers.size()];
+            std::lock_guard lock(victim.mutex);
+            if (victim.tasks.empty()) continue;
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void Run(size_t index) {
+        std::function<void()> task;
+        while (true) {
+            if (PopOwn(index, task) || Steal(index, task)) {
+                m_queued.fetch_sub(1, std::memory_order_relaxed);
+                task();
+                task = nullptr;
+                if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::lock_guard lock(m_mutex);
+                    m_done.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock lock(m_mutex);
+            m_wake.wait(lock, [this](){ return m_stopping || m_queued.load(std::memory_order_relaxed) > 0; });
+            if (m_stopping) return;
+        }
+    }
+
+public:
+    WorkerPool(size_t thread_count) {
+        if (thread_count == 0) thread_count = 1;
+        for (size_t i = 0; i < thread_count; i++) m_workers.push_back(std::make_unique<Worker>());
+        for (size_t i = 0; i < thread_count; i++) m_threads.emplace_back([this, i](){ Run(i); });
+    }
+
+    ~WorkerPool() {
+        {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& thread : m_threads) thread.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // called from one thread only, spreads tasks round robin over the workers
+    void Submit(std::function<void()> task) {
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        {
+        // counted before it's visible, so a worker that takes it can't drive the count below zero
+        std::lock_guard lock(m_mutex);
+        m_queued.fetch_add(1, std::memory_order_relaxed);
+        }
+        {
+        Worker& worker = *m_workers[m_next_worker];
+        std::lock_guard lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+        }
+        m_next_worker = (m_next_worker + 1) % m_workers.size();
+        m_wake.notify_one();
+    }
+
+    // blocks until every submitted task has finished
+    void Wait() {
+        std::unique_lock lock(m_mutex);
+        m_done.wait(lock, [this](){ return m_pending.load(std::memory_order_acquire) == 0; });
+    }
+
+    size_t Size() const { return m_threads.size(); }
+};
@@ -0,0 +1,187 @@
+#include "shared.hpp"
+#include "AllocationCounter.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+
+// microbenchmarks for the simulation and codec hot paths
+// usage: bench [seed] [name filter]
+// prints csv: benchmark,players,events_per_tick,seed,iterations,ns_per_op_min,ns_per_op_median,allocations_per_op
+// allocations_per_op is only counted when built with COUNT_ALLOCATIONS
+
+uint32_t seed = 1;
+std::string filter;
+
+constexpr uint32_t player_counts[] = {2, 16, 128, 1024, 4096};
+constexpr float event_densities[] = {0.f, 0.1f, 1.f}; // input events per player per tick
+constexpr int samples = 7;
+constexpr double sample_seconds = 0.05;
+
+volatile float sink; // keeps results observable so the work isn't optimized away
+
+GameState MakeState(uint32_t players, std::mt19937& rng) {
+    std::uniform_real_distribution<float> pos(-500, 500);
+    std::uniform_real_distribution<float> vel(-5, 5);
+    GameState state;
+    for (uint32_t i = 0; i < players; i++) {
+        state.players.Set(rng(), PlayerState{{pos(rng), pos(rng)}, {vel(rng), vel(rng)}});
+    }
+    return state;
+}
+
+// adds inputs for ticks [start_tick, end_tick) to game, density per player per tick
+void AddInputs(Game& game, const GameState& state, uint32_t start_tick, uint32_t end_tick, float density, std::mt19937& rng) {
+    std::uniform_real_distribution<float> chance(0, 1);
+    for (uint32_t tick = start_tick; tick < end_tick; tick++) {
+        for (size_t i = 0; i < state.players.Size(); i++) {
+            if (chance(rng) >= density) continue;
+            game.AddEvent(GameEvent{PlayerInput{bool(rng() & 1), bool(rng() & 2), bool(rng() & 4)}}, state.players.IdAt(i), tick);
+        }
+    }
+}
+
+// runs op in batches until a sample lasts sample_seconds, reports min and median ns per op
+void Run(const std::string& name, uint32_t players, float density, const std::function<void()>& op) {
+    if (!filter.empty() && name.find(filter) == std::string::npos) return;
+    using clock = std::chrono::steady_clock;
+
+    uint64_t iterations = 1;
+    while (true) {
+        auto start = clock::now();
+        for (uint64_t i = 0; i < iterations; i++) op();
+        if (std::chrono::duration<double>(clock::now() - start).count() >= sample_seconds) break;
+        iterations *= 2;
+    }
+
+    std::vector<double> ns_per_op;
+    ns_per_op.reserve(samples);
+    uint64_t allocations = ThreadAllocations();
+    for (int s = 0; s < samples; s++) {
+        auto start = clock::now();
+        for (uint64_t i = 0; i < iterations; i++) op();
+        ns_per_op.push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count() / iterations);
+    }
+    allocations = ThreadAllocations() - allocations;
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+
+    std::cout << name << "," << players << "," << density << "," << seed << "," << iterations << ","
+              << ns_per_op.front() << "," << ns_per_op[samples/2] << ","
+              << double(allocations) / (iterations * samples) << std::endl;
+}
+
+void BenchPlayers(uint32_t players) {
+    std::mt19937 rng(seed + players);
+    Game game;
+    GameState state = MakeState(players, rng);
+
+    // in place, damping and the floor keep the state bounded however often it runs
+    GameState logic_state = state;
+    Run("update_game_logic", players, 0, [&]() {
+        game.UpdateGameLogic(logic_state);
+        sink = logic_state.players.Empty() ? 0 : logic_state.players.At(0).position.x;
+    });
+
+    Run("serialize", players, 0, [&]() {
+        sink = game.Serialize(state).bytes.size();
+    });
+
+    SerializedGameState encoded;
+    Run("serialize_into", players, 0, [&]() {
+        game.SerializeInto(encoded, state, game.SnapshotQuantization());
+        sink = encoded.bytes.size();
+    });
+
+    SerializedGameState data = game.Serialize(state);
+    Run("deserialize", players, 0, [&]() {
+        sink = game.Deserialize(data).players.Size();
+    });
+
+    GameState decoded;
+    Run("deserialize_into", players, 0, [&]() {
+        game.DeserializeInto(decoded, data);
+        sink = decoded.players.Size();
+    });
+
+    // a tenth of the players moved since the baseline
+    GameState moved = state;
+    for (size_t i = 0; i < moved.players.Size(); i += 10) {
+        PlayerState player = moved.players.At(i);
+        player.position.x += 1;
+        moved.players.SetAt(i, player);
+    }
+    Run("serialize_delta", players, 0.1f, [&]() {
+        sink = game.SerializeDelta(state, moved).bytes.size();
+    });
+
+    SerializedGameState delta = game.SerializeDelta(state, moved);
+    Run("deserialize_delta", players, 0.1f, [&]() {
+        sink = game.DeserializeDelta(state, delta).players.Size();
+    });
+
+    uint32_t except_id = 0;
+    Run("lerp", players, 0, [&]() {
+        sink = game.Lerp(state, moved, 0.5f, &except_id).players.Size();
+    });
+
+    GameState lerped;
+    Run("lerp_into", players, 0, [&]() {
+        game.LerpInto(lerped, state, moved, 0.5f, &except_id);
+        sink = lerped.players.Size();
+    });
+}
+
+void BenchEvents(uint32_t players, float density) {
+    std::mt19937 rng(seed + players);
+    GameState state = MakeState(players, rng);
+
+    // one server broadcast worth of resimulation
+    Game game;
+    AddInputs(game, state, 0, receive_tick_period, density, rng);
+    Run("apply_events", players, density, [&]() {
+        GameState s = game.ApplyEvents(state, 0, receive_tick_period);
+        sink = s.players.Empty() ? 0 : s.players.At(0).velocity.x;
+    });
+
+    GameState applied;
+    Run("apply_events_in_place", players, density, [&]() {
+        applied = state;
+        game.ApplyEventsInPlace(applied, 0, receive_tick_period);
+        sink = applied.players.Empty() ? 0 : applied.players.At(0).velocity.x;
+    });
+
+    // steady state: every op adds tick_period ticks of events and drops as many old ones,
+    // the events are generated up front so only AddEvent and DropEventHistory are timed
+    Game history;
+    AddInputs(history, state, 0, receive_tick_period, density, rng);
+    std::vector<std::pair<uint32_t, GameEvent>> chunk[tick_period];
+    std::uniform_real_distribution<float> chance(0, 1);
+    for (uint32_t t = 0; t < tick_period; t++) {
+        for (size_t i = 0; i < state.players.Size(); i++) {
+            if (chance(rng) < density) chunk[t].push_back({state.players.IdAt(i), GameEvent{PlayerInput{true, false, false}}});
+        }
+    }
+    uint32_t tick = 0;
+    Run("drop_event_history", players, density, [&]() {
+        for (uint32_t t = 0; t < tick_period; t++) {
+            for (auto& [id, event] : chunk[t]) history.AddEvent(event, id, tick + receive_tick_period + t);
+        }
+        history.DropEventHistory(tick + tick_period - 1);
+        tick += tick_period;
+    });
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) seed = std::stoul(argv[1]);
+    if (argc > 2) filter = argv[2];
+
+    std::cout << "benchmark,players,events_per_tick,seed,iterations,ns_per_op_min,ns_per_op_median,allocations_per_op" << std::endl;
+    for (uint32_t players : player_counts) {
+        BenchPlayers(players);
+        for (float density : event_densities) {
+            BenchEvents(players, density);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "GameClient.hpp"
+#include "BotBrain.hpp"
+#include <chrono>
+#include <random>
+#include <thread>
+#include <string>
+
+// headless load generator: ramps up simulated players against a running server
+// usage: bots [ip] [port] [max_bots] [bots_per_step] [seconds_per_step] [seed] [random|script]
+
+std::string server_ip = "127.0.0.1";
+uint32_t max_bots = 200;
+uint32_t bots_per_step = 20;
+uint32_t seconds_per_step = 5;
+uint32_t seed = 1;
+bool scripted = false;
+
+struct Bot {
+    std::unique_ptr<GameClient> client;
+    BotBrain brain;
+};
+
+std::vector<Bot> bots;
+
+void ParseArgs(int argc, char** argv);
+void SpawnBots(uint32_t count);
+void Report();
+
+int main(int argc, char** argv) {
+    ParseArgs(argc, argv);
+    EasyNetInit();
+
+    std::cout << "bots,connected,server_players,server_avg_ms,server_max_ms,headroom_pct,"
+                 "avg_snapshot_bytes,max_snapshot_bytes,reconcile_avg_us,reconcile_max_us,resimulated_pct,checksum_mismatches,first_mismatch_tick,self_divergences,first_divergent_tick,extrapolated_frames,clock_snaps,max_clock_error_ticks" << std::endl;
+
+    uint32_t ticks_per_step = seconds_per_step*iters_per_sec;
+    auto next_tick = std::chrono::steady_clock::now();
+
+    for (uint32_t tick = 0; ; tick++) {
+        if (tick % ticks_per_step == 0) {
+            if (tick > 0) Report();
+            if (bots.size() >= max_bots && tick > 0) break;
+            SpawnBots(std::min(bots_per_step, max_bots - uint32_t(bots.size())));
+        }
+
+        for (Bot& bot : bots) {
+            bot.client->GetNetClient()->Update();
+            if (bot.client->IsConnected()) bot.client->Update(bot.brain.Next());
+        }
+
+        next_tick += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(dt)
+        );
+        std::this_thread::sleep_until(next_tick);
+    }
+
+    for (Bot& bot : bots) {
+        bot.client->GetNetClient()->RequestDisconnectFromServer();
+        bot.client->GetNetClient()->Update();
+    }
+    return 0;
+}
+
+void ParseArgs(int argc, char** argv) {
+    if (argc > 1) server_ip = argv[1];
+    if (argc > 2) server_port = std::stoi(argv[2]);
+    if (argc > 3) max_bots = std::stoul(argv[3]);
+    if (argc > 4) bots_per_step = std::max(1ul, std::stoul(argv[4]));
+    if (argc > 5) seconds_per_step = std::max(1ul, std::stoul(argv[5]));
+    if (argc > 6) seed = std::stoul(argv[6]);
+    if (argc > 7) scripted = std::string(argv[7]) == "script";
+}
+
+void SpawnBots(uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t bot_seed = seed * 7919 + bots.size();
+        Bot bot{std::make_unique<GameClient>(), BotBrain(bot_seed, scripted)};
+        bot.client->GetNetClient()->RequestConnectToServer(server_ip, server_port);
+        bots.push_back(std::move(bot));
+    }
+}
+
+// one csv line per ramp step, stats cover that step only
+void Report() {
+    using us = std::chrono::duration<double, std::micro>;
+
+    uint32_t connected = 0;
+    uint64_t snapshots = 0, snapshot_bytes = 0, max_snapshot_bytes = 0;
+    uint64_t reconciles = 0, resimulations = 0;
+    uint64_t checksum_mismatches = 0;
+    uint64_t extrapolated_frames = 0;
+    uint64_t clock_snaps = 0;
+    float max_clock_error_ticks = 0;
+    bool has_mismatch = false;
+    uint32_t first_mismatch_tick = 0;
+    uint64_t self_divergences = 0;
+    bool has_divergence = false;
+    uint32_t first_divergent_tick = 0;
+    std::chrono::steady_clock::duration reconcile_sum{}, reconcile_max{};
+    ServerStatsPacketData server{};
+
+    for (Bot& bot : bots) {
+        const ClientStats& stats = bot.client->GetStats();
+        if (bot.client->IsConnected()) connected++;
+        snapshots += stats.snapshots_received;
+        snapshot_bytes += stats.snapshot_bytes;
+        max_snapshot_bytes = std::max<uint64_t>(max_snapshot_bytes, stats.max_snapshot_bytes);
+        reconciles += stats.reconciles;
+        resimulations += stats.resimulations;
+        checksum_mismatches += stats.checksum_mismatches;
+        extrapolated_frames += stats.extrapolated_frames;
+        clock_snaps += stats.clock_snaps;
+        max_clock_error_ticks = std::max(max_clock_error_ticks, stats.max_clock_error_ticks);
+        if (stats.has_mismatch && (!has_mismatch || stats.first_mismatch_tick < first_mismatch_tick)) {
+            first_mismatch_tick = stats.first_mismatch_tick;
+            has_mismatch = true;
+        }
+        self_divergences += stats.self_divergences;
+        if (stats.has_divergence && (!has_divergence || stats.first_divergent_tick < first_divergent_tick)) {
+            first_divergent_tick = stats.first_divergent_tick;
+            has_divergence = true;
+        }
+        reconcile_sum += stats.reconcile_time_sum;
+        reconcile_max = std::max(reconcile_max, stats.reconcile_time_max);
+        if (stats.has_server_stats && stats.server_stats.tick >= server.tick) server = stats.server_stats;
+        bot.client->ResetStats();
+    }
+
+    double budget_ms = dt * 1000;
+    std::cout << bots.size() << "," << connected << "," << server.player_count << ","
+              << server.avg_update_ms << "," << server.max_update_ms << ","
+              << 100 * (budget_ms - server.max_update_ms) / budget_ms << ","
+              << (snapshots ? snapshot_bytes / snapshots : 0) << "," << max_snapshot_bytes << ","
+              << (reconciles ? us(reconcile_sum).count() / reconciles : 0) << ","
+              << us(reconcile_max).count() << ","
+              << (reconciles ? 100.0 * resimulations / reconciles : 0) << ","
+              << checksum_mismatches << "," << (has_mismatch ? std::to_string(first_mismatch_tick) : "") << ","
+              << self_divergences << "," << (has_divergence ? std::to_string(first_divergent_tick) : "") << ","
+              << extrapolated_frames << "," << clock_snaps << "," << max_clock_error_ticks << std::endl;
+}
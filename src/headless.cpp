@@ -0,0 +1,76 @@
+#include "GameHeadless.hpp"
+#include "WorkerPool.hpp"
+#include <string>
+#include <thread>
+
+// runs the simulation without a window as fast as the cpu allows
+// usage: headless [ticks] [players] [runs] [threads] [seed] [random|script]
+//        headless replay <file>
+// prints csv, one line per run
+
+uint64_t ticks = iters_per_sec*60*60; // an hour of game time
+uint32_t players = 64;
+uint32_t runs = 1;
+uint32_t threads = 1;
+uint32_t seed = 1;
+bool scripted = false;
+
+void PrintState(const GameState& state) {
+    std::cout << state.players.Size() << "," << std::hex << GameHeadless().Checksum(state) << std::dec;
+}
+
+int RunReplay(const std::string& path) {
+    ReplayReader reader(path);
+    if (!reader.IsOpen()) {
+        std::cout << "not a replay file: " << path << std::endl;
+        return 1;
+    }
+    HeadlessResult result = GameHeadless().RunRecorded(reader);
+
+    std::cout << "ticks,events,seconds,ticks_per_sec,keyframes_checked,keyframe_mismatches,"
+                 "checksums_checked,checksum_mismatches,first_mismatch_tick,gaps,final_players,checksum" << std::endl;
+    std::cout << result.ticks << "," << result.events << "," << result.seconds << "," << result.TicksPerSecond() << ","
+              << result.keyframes_checked << "," << result.keyframe_mismatches << ","
+              << result.checksums_checked << "," << result.checksum_mismatches << ","
+              << (result.has_mismatch ? std::to_string(result.first_mismatch_tick) : "") << "," << result.gaps << ",";
+    PrintState(result.final_state);
+    std::cout << std::endl;
+    return result.has_mismatch ? 2 : 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2 && std::string(argv[1]) == "replay") return RunReplay(argv[2]);
+
+    if (argc > 1) ticks = std::stoull(argv[1]);
+    if (argc > 2) players = std::stoul(argv[2]);
+    if (argc > 3) runs = std::max(1ul, std::stoul(argv[3]));
+    if (argc > 4) threads = std::max(1ul, std::stoul(argv[4]));
+    if (argc > 5) seed = std::stoul(argv[5]);
+    if (argc > 6) scripted = std::string(argv[6]) == "script";
+
+    // every run is independent, seeded seed + run
+    std::vector<HeadlessResult> results(runs);
+    auto start = std::chrono::steady_clock::now();
+    {
+    WorkerPool workers(threads);
+    for (uint32_t run = 0; run < runs; run++) {
+        workers.Submit([&results, run]() {
+            results[run] = GameHeadless().RunScripted(ticks, players, seed + run, scripted);
+        });
+    }
+    workers.Wait();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "run,seed,players,ticks,events,seconds,ticks_per_sec,final_players,checksum" << std::endl;
+    for (uint32_t run = 0; run < runs; run++) {
+        const HeadlessResult& result = results[run];
+        std::cout << run << "," << seed + run << "," << players << "," << result.ticks << "," << result.events << ","
+                  << result.seconds << "," << result.TicksPerSecond() << ",";
+        PrintState(result.final_state);
+        std::cout << std::endl;
+    }
+    std::cout << "total," << seed << "," << players << "," << ticks * runs << ",," << seconds << ","
+              << (seconds > 0 ? ticks * runs / seconds : 0) << ",," << std::endl;
+    return 0;
+}
@@ -0,0 +1,268 @@
+#include "shared.hpp"
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// udp relay between clients and a server that impairs the traffic, so the netcode can be measured
+// under loss and jitter on one machine. every client gets its own upstream socket, the server sees
+// one peer per client as usual. impairments apply to each direction separately, latency is one way
+// usage: netproxy [listen_port] [server_ip] [server_port] [latency_ms] [jitter_ms] [loss] [duplicate] [reorder] [seed] [report_seconds]
+// then point client or bots at listen_port. prints one csv line per flow and direction every report
+
+using Clock = std::chrono::steady_clock;
+using Ms = std::chrono::duration<double, std::milli>;
+
+constexpr uint32_t proxy_socket_buffer = 1 << 20;
+constexpr uint32_t proxy_max_datagram = 1 << 16;
+constexpr auto proxy_poll_interval = std::chrono::microseconds(500);
+constexpr auto proxy_flow_timeout = std::chrono::seconds(10); // ENet gives up on a silent peer before this
+constexpr double proxy_reorder_hold_ms = 20; // a reordered packet is held this much longer, later ones overtake it
+
+uint16_t listen_port = 7778;
+std::string server_ip = "127.0.0.1";
+double latency_ms = 50;
+double jitter_ms = 10; // each packet's delay is latency +- jitter, uniform
+double loss = 0.01;
+double duplicate = 0;
+double reorder = 0;
+uint32_t seed = 1;
+uint32_t report_seconds = 5;
+
+enum Direction { TO_SERVER = 0, TO_CLIENT = 1 };
+constexpr const char* direction_names[2] = {"to_server", "to_client"};
+
+// counters for one report window
+struct DirectionStats {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t dropped = 0;
+    uint64_t duplicated = 0;
+    uint64_t reordered = 0;
+    uint64_t delivered = 0;
+    double delay_sum_ms = 0;
+    double max_delay_ms = 0;
+};
+
+struct Flow {
+    ENetAddress client{};
+    std::string name; // ip:port of the client
+    ENetSocket upstream = ENET_SOCKET_NULL;
+    Clock::time_point last_seen{};
+    std::array<Clock::time_point, 2> last_delivery{}; // keeps jitter alone from reordering packets
+    std::array<DirectionStats, 2> stats{};
+};
+
+struct DelayedPacket {
+    Clock::time_point deliver_at;
+    uint64_t sequence; // ties keep send order
+    uint32_t flow_id;
+    Direction direction;
+    Clock::time_point received_at;
+    std::vector<uint8_t> data;
+
+    bool operator>(const DelayedPacket& other) const {
+        return deliver_at != other.deliver_at ? deliver_at > other.deliver_at : sequence > other.sequence;
+    }
+};
+
+ENetSocket listen_socket;
+ENetAddress server_address;
+std::map<std::string, uint32_t> flow_ids; // by client address bytes
+std::map<uint32_t, Flow> flows;
+uint32_t next_flow_id = 0;
+std::priority_queue<DelayedPacket, std::vector<DelayedPacket>, std::greater<DelayedPacket>> delayed;
+uint64_t next_sequence = 0;
+std::mt19937 rng;
+std::array<uint8_t, proxy_max_datagram> receive_buffer;
+
+void ParseArgs(int argc, char** argv);
+ENetSocket OpenSocket(uint16_t port);
+void ReceiveFromClients(Clock::time_point now);
+void ReceiveFromServer(uint32_t flow_id, Flow& flow, Clock::time_point now);
+void Deliver(Clock::time_point now);
+void Report(double seconds, Clock::time_point now);
+
+int main(int argc, char** argv) {
+    ParseArgs(argc, argv);
+    EasyNetInit();
+    rng.seed(seed);
+
+    if (enet_address_set_host(&server_address, server_ip.c_str()) != 0) {
+        std::cout << "can't resolve " << server_ip << std::endl;
+        return 1;
+    }
+    server_address.port = server_port;
+    listen_socket = OpenSocket(listen_port);
+    if (listen_socket == ENET_SOCKET_NULL) {
+        std::cout << "can't listen on port " << listen_port << std::endl;
+        return 1;
+    }
+
+    std::cout << "seconds,flow,client,direction,packets,kbytes_per_sec,dropped,duplicated,reordered,avg_delay_ms,max_delay_ms" << std::endl;
+
+    auto start = Clock::now();
+    auto next_report = start + std::chrono::seconds(report_seconds);
+    while (true) {
+        auto now = Clock::now();
+        ReceiveFromClients(now);
+        for (auto& [id, flow] : flows) ReceiveFromServer(id, flow, now);
+        Deliver(now);
+
+        if (now >= next_report) {
+            Report(Ms(now - start).count() / 1000, now);
+            next_report += std::chrono::seconds(report_seconds);
+        }
+
+        auto wake = now + proxy_poll_interval;
+        if (!delayed.empty() && delayed.top().deliver_at < wake) wake = delayed.top().deliver_at;
+        std::this_thread::sleep_until(wake);
+    }
+    return 0;
+}
+
+void ParseArgs(int argc, char** argv) {
+    if (argc > 1) listen_port = std::stoi(argv[1]);
+    if (argc > 2) server_ip = argv[2];
+    if (argc > 3) server_port = std::stoi(argv[3]);
+    if (argc > 4) latency_ms = std::stod(argv[4]);
+    if (argc > 5) jitter_ms = std::stod(argv[5]);
+    if (argc > 6) loss = std::stod(argv[6]);
+    if (argc > 7) duplicate = std::stod(argv[7]);
+    if (argc > 8) reorder = std::stod(argv[8]);
+    if (argc > 9) seed = std::stoul(argv[9]);
+    if (argc > 10) report_seconds = std::max(1ul, std::stoul(argv[10]));
+}
+
+// non-blocking udp socket, port 0 picks any free one
+ENetSocket OpenSocket(uint16_t port) {
+    ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+    if (socket == ENET_SOCKET_NULL) return socket;
+    ENetAddress address{};
+    address.port = port;
+    enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+    enet_socket_set_option(socket, ENET_SOCKOPT_RCVBUF, proxy_socket_buffer);
+    enet_socket_set_option(socket, ENET_SOCKOPT_SNDBUF, proxy_socket_buffer);
+    if (enet_socket_bind(socket, &address) != 0) {
+        enet_socket_destroy(socket);
+        return ENET_SOCKET_NULL;
+    }
+    return socket;
+}
+
+// 0 when nothing is waiting
+int Receive(ENetSocket socket, ENetAddress& from) {
+    ENetBuffer buffer{receive_buffer.size(), receive_buffer.data()};
+    return enet_socket_receive(socket, &from, &buffer, 1);
+}
+
+// drops, duplicates, delays and reorders one datagram on its way
+void Impair(uint32_t flow_id, Flow& flow, Direction direction, int size, Clock::time_point now) {
+    std::uniform_real_distribution<double> chance(0, 1);
+    std::uniform_real_distribution<double> spread(-1, 1);
+    DirectionStats& stats = flow.stats[direction];
+    stats.packets++;
+    stats.bytes += size;
+    if (chance(rng) < loss) {
+        stats.dropped++;
+        return;
+    }
+
+    int copies = 1;
+    if (chance(rng) < duplicate) {
+        copies = 2;
+        stats.duplicated++;
+    }
+    for (int i = 0; i < copies; i++) {
+        double delay_ms = std::max(0.0, latency_ms + jitter_ms * spread(rng));
+        auto deliver_at = now + std::chrono::duration_cast<Clock::duration>(Ms(delay_ms));
+        if (chance(rng) < reorder) {
+            deliver_at += std::chrono::duration_cast<Clock::duration>(Ms(proxy_reorder_hold_ms));
+            stats.reordered++;
+        }
+        else {
+            deliver_at = std::max(deliver_at, flow.last_delivery[direction]);
+            flow.last_delivery[direction] = deliver_at;
+        }
+        delayed.push(DelayedPacket{deliver_at, next_sequence++, flow_id, direction, now,
+                                   std::vector<uint8_t>(receive_buffer.begin(), receive_buffer.begin() + size)});
+    }
+}
+
+std::string AddressKey(const ENetAddress& address) {
+    return std::string(reinterpret_cast<const char*>(&address.host), sizeof(address.host)) + std::to_string(address.port);
+}
+
+void ReceiveFromClients(Clock::time_point now) {
+    ENetAddress from;
+    int size;
+    while ((size = Receive(listen_socket, from)) > 0) {
+        std::string key = AddressKey(from);
+        auto it = flow_ids.find(key);
+        if (it == flow_ids.end()) {
+            ENetSocket upstream = OpenSocket(0);
+            if (upstream == ENET_SOCKET_NULL) continue;
+            char ip[64];
+            enet_address_get_host_ip(&from, ip, sizeof(ip));
+            it = flow_ids.emplace(key, next_flow_id).first;
+            flows[next_flow_id] = Flow{from, std::string(ip) + ":" + std::to_string(from.port), upstream, now};
+            next_flow_id++;
+        }
+        Flow& flow = flows[it->second];
+        flow.last_seen = now;
+        Impair(it->second, flow, TO_SERVER, size, now);
+    }
+}
+
+void ReceiveFromServer(uint32_t flow_id, Flow& flow, Clock::time_point now) {
+    ENetAddress from;
+    int size;
+    while ((size = Receive(flow.upstream, from)) > 0) Impair(flow_id, flow, TO_CLIENT, size, now);
+}
+
+void Deliver(Clock::time_point now) {
+    while (!delayed.empty() && delayed.top().deliver_at <= now) {
+        const DelayedPacket& packet = delayed.top();
+        auto it = flows.find(packet.flow_id);
+        if (it != flows.end()) { // gone when the flow timed out meanwhile
+            Flow& flow = it->second;
+            ENetBuffer buffer{packet.data.size(), const_cast<uint8_t*>(packet.data.data())};
+            if (packet.direction == TO_SERVER) enet_socket_send(flow.upstream, &server_address, &buffer, 1);
+            else enet_socket_send(listen_socket, &flow.client, &buffer, 1);
+
+            DirectionStats& stats = flow.stats[packet.direction];
+            double delay_ms = Ms(now - packet.received_at).count();
+            stats.delivered++;
+            stats.delay_sum_ms += delay_ms;
+            stats.max_delay_ms = std::max(stats.max_delay_ms, delay_ms);
+        }
+        delayed.pop();
+    }
+}
+
+// stats cover the window since the last report. flows silent for too long are closed afterwards
+void Report(double seconds, Clock::time_point now) {
+    for (auto it = flows.begin(); it != flows.end();) {
+        auto& [id, flow] = *it;
+        for (int direction = 0; direction < 2; direction++) {
+            DirectionStats& stats = flow.stats[direction];
+            std::cout << seconds << "," << id << "," << flow.name << "," << direction_names[direction] << ","
+                      << stats.packets << "," << stats.bytes / 1024.0 / report_seconds << ","
+                      << stats.dropped << "," << stats.duplicated << "," << stats.reordered << ","
+                      << (stats.delivered ? stats.delay_sum_ms / stats.delivered : 0) << "," << stats.max_delay_ms << std::endl;
+            stats = DirectionStats{};
+        }
+
+        if (now - flow.last_seen > proxy_flow_timeout) {
+            enet_socket_destroy(flow.upstream);
+            flow_ids.erase(AddressKey(flow.client));
+            it = flows.erase(it);
+        }
+        else it++;
+    }
+}
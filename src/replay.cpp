@@ -0,0 +1,85 @@
+#include "Game.hpp"
+#include "ReplayLog.hpp"
+#include <chrono>
+#include <string>
+
+// inspects a recorded match
+// usage: replay <file>            keyframe index and tick range
+//        replay <file> <tick>     state at the start of tick, simulated from the nearest keyframe
+
+// state at the start of tick, false if the recording doesn't cover it
+bool StateAt(const ReplayReader& reader, uint32_t tick, GameState& state) {
+    const ReplayKeyframeEntry* keyframe = reader.KeyframeBefore(tick);
+    if (!keyframe) return false;
+
+    Game game;
+    ReplayRecord record;
+    if (!reader.RecordAt(keyframe->offset, record) || record.type != REPLAY_KEYFRAME) return false;
+    SerializedGameState data;
+    data.bytes.assign(record.payload, record.payload + record.size);
+    state = game.Deserialize(data);
+
+    uint32_t state_tick = keyframe->tick;
+    for (uint64_t offset = record.next_offset; state_tick < tick && reader.RecordAt(offset, record); offset = record.next_offset) {
+        if (record.type == REPLAY_CHECKSUM && record.tick == state_tick) {
+            if (game.Checksum(state) != ReplayReader::ReadChecksum(record)) {
+                std::cout << "diverged from the recording at tick " << state_tick << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (record.type != REPLAY_EVENTS) continue;
+        if (record.tick != state_tick) return false; // the writer dropped data here
+
+        uint32_t end_tick = game.AddSerializedEvents(record.tick, record.payload, record.size);
+        if (end_tick == record.tick) return false;
+        uint32_t until = std::min(end_tick, tick);
+        state = game.ApplyEvents(state, state_tick, until);
+        game.DropEventHistory(until - 1);
+        state_tick = until;
+    }
+    return state_tick == tick;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cout << "usage: replay <file> [tick]" << std::endl;
+        return 1;
+    }
+
+    auto open_start = std::chrono::steady_clock::now();
+    ReplayReader reader(argv[1]);
+    auto open_time = std::chrono::steady_clock::now() - open_start;
+    if (!reader.IsOpen()) {
+        std::cout << "not a replay file: " << argv[1] << std::endl;
+        return 1;
+    }
+
+    using ms = std::chrono::duration<double, std::milli>;
+    const auto& keyframes = reader.Keyframes();
+    std::cout << "ticks_per_second " << reader.TicksPerSecond() << "\n";
+    std::cout << "complete " << reader.IsComplete() << "\n";
+    std::cout << "keyframes " << keyframes.size() << "\n";
+    if (!keyframes.empty()) {
+        std::cout << "first_keyframe_tick " << keyframes.front().tick << "\n";
+        std::cout << "last_keyframe_tick " << keyframes.back().tick << "\n";
+    }
+    std::cout << "open_ms " << ms(open_time).count() << "\n";
+    if (argc < 3) return 0;
+
+    uint32_t tick = std::stoul(argv[2]);
+    auto seek_start = std::chrono::steady_clock::now();
+    GameState state;
+    if (!StateAt(reader, tick, state)) {
+        std::cout << "tick " << tick << " is not covered by the recording" << std::endl;
+        return 1;
+    }
+    std::cout << "seek_ms " << ms(std::chrono::steady_clock::now() - seek_start).count() << "\n";
+    std::cout << "tick " << tick << " players " << state.players.Size() << "\n";
+    for (size_t i = 0; i < state.players.Size(); i++) {
+        PlayerState player = state.players.At(i);
+        std::cout << state.players.IdAt(i) << " " << player.position.x << " " << player.position.y << " "
+                  << player.velocity.x << " " << player.velocity.y << "\n";
+    }
+    return 0;
+}
@@ -1,20 +1,42 @@
 #include "GameServer.hpp"
+#include "WorkerPool.hpp"
+#include <string>
 #include <thread>
 
-std::unique_ptr<GameServer> game_server;
+// usage: server [rooms] [worker threads] [egress KB/s]
+// every room is an independent match, one by default. new peers fill a room before the next gets any.
+// egress 0 (default) leaves outbound bandwidth uncapped
+
+std::unique_ptr<ServerNetwork> network;
+std::vector<std::unique_ptr<GameServer>> rooms;
 bool running = true;
 
-int main(){
-    std::cout << "Server running" << std::endl;
+int main(int argc, char** argv){
+    uint32_t hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t room_count = argc > 1 ? std::stoul(argv[1]) : 1;
+    uint32_t worker_count = argc > 2 ? std::stoul(argv[2]) : hardware_threads;
+    double egress_kbps = argc > 3 ? std::stod(argv[3]) : 0;
+
+    std::cout << "Server running, " << room_count << " rooms on " << worker_count << " workers" << std::endl;
     EasyNetInit();
-    game_server = std::make_unique<GameServer>();
+    network = std::make_unique<ServerNetwork>(server_port, room_count, egress_kbps * 1024);
+    for (uint32_t room = 0; room < network->RoomCount(); room++) {
+        rooms.push_back(std::make_unique<GameServer>(network->Room(room), room));
+    }
+    WorkerPool workers(worker_count);
+    network->Start();
 
     auto next_tick = std::chrono::steady_clock::now();
     while (running) {
         auto now = std::chrono::steady_clock::now();
 
         while (now >= next_tick) {
-            game_server->Update();
+            auto lag = std::chrono::steady_clock::now() - next_tick;
+            for (auto& room : rooms) {
+                room->GetProfiler().RecordLag(lag);
+                workers.Submit([&room](){ room->Update(); });
+            }
+            workers.Wait();
 
             next_tick += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
                 std::chrono::duration<double>(dt)
@@ -23,5 +45,6 @@ int main(){
         std::this_thread::sleep_until(next_tick);
     }  
 
+    network->Stop();
     return 0;
-}
\ No newline at end of file
+}
@@ -2,6 +2,7 @@
 
 #include <EasyNet/EasyNetShared.hpp>
 #include "Game.hpp"
+#include "Lz.hpp"
 
 int server_port = 7777;
 
@@ -9,10 +10,111 @@ constexpr MessageType MSG_PLAYER_INPUT = MSG_USER_BASE;
 constexpr MessageType MSG_GAME_STATE = MSG_USER_BASE+1;
 constexpr MessageType MSG_GAME_TICK = MSG_USER_BASE+2;
 constexpr MessageType MSG_PLAYER_ID = MSG_USER_BASE+3;
+constexpr MessageType MSG_SNAPSHOT_ACK = MSG_USER_BASE+4;
+constexpr MessageType MSG_SERVER_STATS = MSG_USER_BASE+5;
+constexpr MessageType MSG_TIME_SYNC_REQUEST = MSG_USER_BASE+6;
+constexpr MessageType MSG_TIME_SYNC = MSG_USER_BASE+7;
 
-struct PlayerInputPacketData {
-    PlayerInput input;
+// true if packet holds a message type and a T after it. ExtractData reads that much unchecked,
+// so anything from a peer is checked with this first
+template<typename T>
+bool HasData(const ENetPacket* packet) {
+    return packet->dataLength >= sizeof(MessageType) + sizeof(T);
+}
+
+// clients send their recent inputs in batches, each input is repeated in several packets
+// so a lost packet costs nothing. the server keeps the first copy of every tick
+constexpr uint32_t input_send_period = 2;       // ticks between input packets
+constexpr uint32_t input_redundancy_ticks = 8;  // an input is resent until it's this old
+
+struct InputBatch {
+    uint32_t newest_tick = 0; // the sender's inputs up to this tick are all in this batch or earlier ones
+    std::vector<std::pair<uint32_t, PlayerInput>> inputs; // tick, input; oldest first
+};
+
+// layout: message type, newest tick, count, then per input: ticks before newest, input bits
+inline ENetPacket* CreateInputBatchPacket(MessageType msg_type, const InputBatch& batch, enet_uint32 flags = ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT) {
+    std::vector<uint8_t> bytes;
+    ByteWriter writer(bytes);
+    writer.WriteVarU32(batch.newest_tick);
+    writer.WriteVarU32(batch.inputs.size());
+    for (auto& [tick, input] : batch.inputs) {
+        writer.WriteVarU32(batch.newest_tick - tick);
+        writer.WriteU8(input.Pack());
+    }
+
+    ENetPacket* packet = enet_packet_create(nullptr, sizeof(MessageType) + bytes.size(), flags);
+    std::memcpy(packet->data, &msg_type, sizeof(MessageType));
+    std::memcpy(packet->data + sizeof(MessageType), bytes.data(), bytes.size());
+    return packet;
+}
+
+inline bool ExtractInputBatch(ENetPacket* packet, InputBatch& batch) {
+    if (packet->dataLength < sizeof(MessageType)) return false;
+    ByteReader reader(packet->data + sizeof(MessageType), packet->dataLength - sizeof(MessageType));
+    batch.newest_tick = reader.ReadVarU32();
+    uint32_t count = reader.ReadVarU32();
+    batch.inputs.clear();
+    for (uint32_t i = 0; i < count && reader.Ok(); i++) {
+        uint32_t age = reader.ReadVarU32();
+        uint8_t bits = reader.ReadU8();
+        if (reader.Ok() && age <= batch.newest_tick) batch.inputs.push_back({batch.newest_tick - age, PlayerInput::Unpack(bits)});
+    }
+    return reader.Ok();
+}
+
+// sent once a second, lets load tools see how close the server is to its tick budget
+struct ServerStatsPacketData {
     uint32_t tick;
+    uint32_t player_count;
+    float avg_update_ms; // GameServer::Update over the last second
+    float max_update_ms;
+};
+
+// clock sync, ntp style: the client stamps a request with its own clock, the server answers with its
+// tick, fractional, when the request arrived and when the answer left. the client then knows the rtt
+// without the server's hold time, and the server's tick at its own clock to within half of it
+struct TimeSyncRequestPacketData {
+    double client_time; // seconds
+};
 
-    PlayerInputPacketData() = default;
+struct TimeSyncPacketData {
+    double client_time;        // echoed
+    double server_receive_tick;
+    double server_send_tick;
 };
+
+// snapshots have a variable size, so they can't go through CreatePacket<T>
+// layout: message type, tick, baseline tick, checksum, self checksum, codec bytes
+constexpr size_t snapshot_header_size = sizeof(MessageType) + 4*sizeof(uint32_t);
+constexpr size_t snapshot_max_inflated_size = 1 << 20; // far above any real snapshot, bounds what a bad packet makes us allocate
+
+inline ENetPacket* CreateSnapshotPacket(MessageType msg_type, const SerializedGameState& data, enet_uint32 flags = ENET_PACKET_FLAG_RELIABLE) {
+    ENetPacket* packet = enet_packet_create(nullptr, snapshot_header_size + data.bytes.size(), flags);
+    std::memcpy(packet->data, &msg_type, sizeof(MessageType));
+    std::memcpy(packet->data + sizeof(MessageType), &data.tick, sizeof(uint32_t));
+    std::memcpy(packet->data + sizeof(MessageType) + sizeof(uint32_t), &data.baseline_tick, sizeof(uint32_t));
+    std::memcpy(packet->data + sizeof(MessageType) + 2*sizeof(uint32_t), &data.checksum, sizeof(uint32_t));
+    std::memcpy(packet->data + sizeof(MessageType) + 3*sizeof(uint32_t), &data.self_checksum, sizeof(uint32_t));
+    std::memcpy(packet->data + snapshot_header_size, data.bytes.data(), data.bytes.size());
+    return packet;
+}
+
+inline bool ExtractSnapshot(ENetPacket* packet, SerializedGameState& data) {
+    if (packet->dataLength < snapshot_header_size) return false;
+    std::memcpy(&data.tick, packet->data + sizeof(MessageType), sizeof(uint32_t));
+    std::memcpy(&data.baseline_tick, packet->data + sizeof(MessageType) + sizeof(uint32_t), sizeof(uint32_t));
+    std::memcpy(&data.checksum, packet->data + sizeof(MessageType) + 2*sizeof(uint32_t), sizeof(uint32_t));
+    std::memcpy(&data.self_checksum, packet->data + sizeof(MessageType) + 3*sizeof(uint32_t), sizeof(uint32_t));
+    data.bytes.assign(packet->data + snapshot_header_size, packet->data + packet->dataLength);
+
+    // the codec never sees compression, inflate here and clear the flag
+    if (!data.bytes.empty() && (data.bytes[0] & SNAPSHOT_COMPRESSED)) {
+        static thread_local std::vector<uint8_t> inflated;
+        inflated.clear();
+        inflated.push_back(data.bytes[0] & ~SNAPSHOT_COMPRESSED);
+        if (!LzDecompress(data.bytes.data() + 1, data.bytes.size() - 1, inflated, snapshot_max_inflated_size)) return false;
+        data.bytes.swap(inflated);
+    }
+    return true;
+}
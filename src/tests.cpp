@@ -0,0 +1,191 @@
+#include "PhysicsKernel.hpp"
+#include "Lz.hpp"
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// self-checking tests, run by ctest. prints every failure, exits non-zero if there was one
+
+int failures = 0;
+
+void Check(bool ok, const char* what) {
+    if (ok) return;
+    std::cout << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+struct PlayerArrays {
+    std::vector<float> px, py, vx, vy;
+
+    bool operator==(const PlayerArrays& other) const {
+        auto same = [](const std::vector<float>& a, const std::vector<float>& b) {
+            return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0);
+        };
+        return same(px, other.px) && same(py, other.py) && same(vx, other.vx) && same(vy, other.vy);
+    }
+};
+
+// positions around the floor, velocities from large down to denormal, both signs
+PlayerArrays RandomPlayers(std::mt19937& rng, size_t count, float floor) {
+    std::uniform_real_distribution<float> position(floor - 500, floor + 10);
+    std::uniform_real_distribution<float> velocity(-50, 50);
+    std::uniform_int_distribution<int> scale(0, 3);
+    PlayerArrays players;
+    for (size_t i = 0; i < count; i++) {
+        players.px.push_back(position(rng));
+        players.py.push_back(position(rng));
+        float v[2] = {velocity(rng), velocity(rng)};
+        for (float& value : v) {
+            switch (scale(rng)) {
+                case 0: value *= FLT_MIN; break;       // denormal
+                case 1: value *= FLT_MIN * 64; break;  // a few damping steps from denormal
+                case 2: value = 0; break;
+                default: break;
+            }
+        }
+        players.vx.push_back(v[0]);
+        players.vy.push_back(v[1]);
+    }
+    return players;
+}
+
+// the scalar path does the tail of every vector path, like IntegratePlayers
+using VectorPath = size_t (*)(float*, float*, float*, float*, size_t, double, float, float);
+
+void RunPath(PlayerArrays& p, VectorPath path, double gravity_step, float floor, float damping) {
+    size_t count = p.px.size();
+    size_t done = path ? path(p.px.data(), p.py.data(), p.vx.data(), p.vy.data(), count, gravity_step, floor, damping) : 0;
+    IntegratePlayersScalar(p.px.data(), p.py.data(), p.vx.data(), p.vy.data(), done, count, gravity_step, floor, damping);
+}
+
+// every compiled in vector path matches the scalar one bit for bit, for counts that leave a tail
+void TestPhysicsPathsAgree() {
+    constexpr double gravity_step = 40.0 / 60;
+    constexpr float floor = 1000;
+    constexpr float damping = 0.9f;
+    constexpr int ticks = 200; // long enough for velocities to damp through the denormal range
+
+    std::vector<std::pair<const char*, VectorPath>> paths;
+#if defined(__AVX__)
+    paths.push_back({"avx", IntegratePlayersAVX});
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    paths.push_back({"sse2", IntegratePlayersSSE2});
+#endif
+    if (paths.empty()) std::cout << "no vector path compiled in, nothing to compare" << std::endl;
+
+    std::mt19937 rng(1);
+    for (size_t count = 0; count <= 41; count++) {
+        PlayerArrays start = RandomPlayers(rng, count, floor);
+        PlayerArrays scalar = start;
+        for (int tick = 0; tick < ticks; tick++) RunPath(scalar, nullptr, gravity_step, floor, damping);
+
+        for (auto& [name, path] : paths) {
+            PlayerArrays vector = start;
+            for (int tick = 0; tick < ticks; tick++) RunPath(vector, path, gravity_step, floor, damping);
+            if (!(vector == scalar)) {
+                std::cout << name << " differs from scalar with " << count << " players" << std::endl;
+                Check(false, "physics paths agree");
+            }
+        }
+    }
+}
+
+std::vector<uint8_t> Compressed(const std::vector<uint8_t>& raw) {
+    LzCompressor compressor;
+    std::vector<uint8_t> packed;
+    compressor.Compress(raw.data(), raw.size(), packed);
+    return packed;
+}
+
+bool Inflates(const std::vector<uint8_t>& packed, const std::vector<uint8_t>& raw, size_t max_raw_size = lz_max_raw_size) {
+    std::vector<uint8_t> out;
+    return LzDecompress(packed.data(), packed.size(), out, max_raw_size) && out == raw;
+}
+
+bool Rejects(const std::vector<uint8_t>& packed, size_t max_raw_size = lz_max_raw_size) {
+    std::vector<uint8_t> out;
+    return !LzDecompress(packed.data(), packed.size(), out, max_raw_size);
+}
+
+void TestLzRoundTrip() {
+    std::mt19937 rng(2);
+    for (size_t size : {0, 1, 3, 4, 5, 17, 255, 256, 1000, 70000}) {
+        std::vector<uint8_t> noise(size), runs(size), snapshot_like(size);
+        for (size_t i = 0; i < size; i++) {
+            noise[i] = uint8_t(rng());
+            runs[i] = uint8_t(i / 300);
+            snapshot_like[i] = i % 21 < 5 ? uint8_t(i / 21) : uint8_t(rng() % 4);
+        }
+        Check(Inflates(Compressed(noise), noise), "lz round trip, noise");
+        Check(Inflates(Compressed(runs), runs), "lz round trip, runs");
+        Check(Inflates(Compressed(snapshot_like), snapshot_like), "lz round trip, snapshot like");
+    }
+
+    // appends after what out already holds
+    std::vector<uint8_t> raw = {1, 2, 3, 1, 2, 3, 1, 2, 3};
+    std::vector<uint8_t> packed = Compressed(raw);
+    std::vector<uint8_t> out = {9, 9};
+    Check(LzDecompress(packed.data(), packed.size(), out) && out == std::vector<uint8_t>({9, 9, 1, 2, 3, 1, 2, 3, 1, 2, 3}), "lz appends");
+}
+
+// hand made streams, see the layout in Lz.hpp
+void TestLzMalformed() {
+    // a match longer than its offset repeats what it is producing: "a" then 9 more from 1 back
+    Check(Inflates({10, 0x15, 'a', 1, 0, 0x00}, std::vector<uint8_t>(10, 'a')), "lz overlapping match");
+    Check(Inflates({8, 0x22, 'a', 'b', 2, 0, 0x00}, {'a', 'b', 'a', 'b', 'a', 'b', 'a', 'b'}), "lz overlapping match, offset 2");
+
+    // offsets reaching before the start, also when out already held bytes before the call
+    Check(Rejects({6, 0x10, 'a', 2, 0, 0x00}), "lz offset before start");
+    Check(Rejects({5, 0x00, 1, 0, 0x10, 'a'}), "lz match before any output");
+    Check(Rejects({5, 0x10, 'a', 0, 0, 0x00}), "lz offset 0");
+    std::vector<uint8_t> before = {7, 0x10, 'a', 3, 0, 0x00};
+    std::vector<uint8_t> out = {1, 2, 3, 4};
+    Check(!LzDecompress(before.data(), before.size(), out), "lz offset into bytes out held before the call");
+
+    // truncated anywhere: refused, or the sequence cut off was the empty last one
+    std::vector<uint8_t> raw(3000);
+    for (size_t i = 0; i < raw.size(); i++) raw[i] = uint8_t(i % 7 == 0 ? i : i / 100);
+    std::vector<uint8_t> packed = Compressed(raw);
+    for (size_t length = 0; length < packed.size(); length++) {
+        std::vector<uint8_t> cut(packed.begin(), packed.begin() + length);
+        std::vector<uint8_t> inflated;
+        if (LzDecompress(cut.data(), cut.size(), inflated)) Check(inflated == raw, "lz truncated input");
+    }
+
+    // lengths past the input or the declared size
+    Check(Rejects({20, 0xF0, 10, 'a'}), "lz literal count past the input");
+    Check(Rejects({3, 0x50, 'a', 'b', 'c', 'd', 'e'}), "lz literals past the raw size");
+    Check(Rejects({100, 0x1F, 'a', 1, 0, 255, 255, 255, 10, 0x00}), "lz match past the raw size");
+    Check(Rejects({100, 0xF0, 255, 255}), "lz length bytes past the input");
+    Check(Rejects({100, 0x1F, 'a', 1, 0, 255}), "lz match length bytes past the input");
+    Check(Rejects({5, 0x10, 'a', 1}), "lz offset cut off");
+    Check(Rejects({9, 0x10, 'a'}), "lz shorter than the raw size");
+
+    // the caller's cap, checked before anything is allocated
+    std::vector<uint8_t> big(5000, 42);
+    std::vector<uint8_t> big_packed = Compressed(big);
+    Check(Inflates(big_packed, big, big.size()), "lz at the cap");
+    Check(Rejects(big_packed, big.size() - 1), "lz over the cap");
+    Check(Rejects({0xFF, 0xFF, 0xFF, 0xFF, 0x0F}), "lz raw size over the default cap");
+
+    // garbage never inflates to more than the cap, and never reads outside src
+    std::mt19937 rng(3);
+    for (int i = 0; i < 20000; i++) {
+        std::vector<uint8_t> garbage(rng() % 64);
+        for (uint8_t& byte : garbage) byte = uint8_t(rng());
+        std::vector<uint8_t> inflated;
+        LzDecompress(garbage.data(), garbage.size(), inflated, 4096);
+        if (inflated.size() > 4096) Check(false, "lz garbage stays under the cap");
+    }
+}
+
+int main() {
+    TestPhysicsPathsAgree();
+    TestLzRoundTrip();
+    TestLzMalformed();
+    if (failures == 0) std::cout << "all tests passed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}